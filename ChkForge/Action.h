@@ -1,7 +1,18 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 
 namespace ChkForge {
   class MapContext;
+  class JournalWriter;
+
+  // Identifies the kind of an action in the journal, values must not change.
+  enum class ActionType : uint8_t {
+    PlaceUnit = 1,
+    TileDelta = 2,
+    PlaceUnits = 3,
+    RemoveUnits = 4
+  };
 
   class Action {
   public:
@@ -15,6 +26,19 @@ namespace ChkForge {
       apply();
     }
 
+    // Takes over an action applied right after this one during a stroke, so
+    // that both are undone in one step. Returns false if it can't.
+    virtual bool merge(const Action& next) { return false; }
+    // Called once nothing more will be merged into the action.
+    virtual void compact() {}
+    // Roughly the memory held by the action, for the undo history's limit.
+    virtual size_t memoryUsage() const = 0;
+
+    // What is needed to construct the action again when the journal is
+    // replayed, see ActionJournal.
+    virtual ActionType type() const = 0;
+    virtual void write(JournalWriter& w) const = 0;
+
   protected:
     MapContext* map;
   };
@@ -0,0 +1,347 @@
+#include "ActionJournal.h"
+#include "Action.h"
+#include "UndoManager.h"
+
+#include <fstream>
+#include <iterator>
+#include <QLockFile>
+#include <QStandardPaths>
+#include <QUuid>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace ChkForge;
+
+namespace {
+  const uint32_t journal_magic = 0x314a4643; // "CFJ1"
+
+  std::filesystem::path journal_dir() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation).toStdWString() + L"/journal";
+  }
+
+  std::filesystem::path lock_path(const std::filesystem::path& path) {
+    std::filesystem::path r = path;
+    r += ".lock";
+    return r;
+  }
+
+  std::unique_ptr<QLockFile> make_lock(const std::filesystem::path& path) {
+    auto lock = std::make_unique<QLockFile>(QString::fromStdWString(lock_path(path).wstring()));
+    // Only a lock whose process is gone is stale, journals can be open for
+    // as long as ChkForge runs.
+    lock->setStaleLockTime(0);
+    return lock;
+  }
+
+  FILE* create_file(const std::filesystem::path& path) {
+#ifdef _WIN32
+    return _wfopen(path.c_str(), L"wb");
+#else
+    return fopen(path.c_str(), "wb");
+#endif
+  }
+
+  std::vector<uint8_t> encode_base(const ActionJournal::Base& base) {
+    std::vector<uint8_t> data;
+    JournalWriter w(data);
+    w.u32(journal_magic);
+    auto map_file = base.map_file.u8string();
+    w.u16(uint16_t(map_file.size()));
+    data.insert(data.end(), map_file.begin(), map_file.end());
+    w.u16(uint16_t(base.tile_width));
+    w.u16(uint16_t(base.tile_height));
+    w.u16(uint16_t(base.tileset));
+    w.u16(uint16_t(base.brush));
+    w.u16(uint16_t(base.clutter));
+    w.u32(uint32_t(base.tiles.size()));
+    for (uint16_t tile : base.tiles) w.u16(tile);
+    return data;
+  }
+
+  ActionJournal::Base decode_base(JournalReader& r) {
+    if (r.u32() != journal_magic) throw std::runtime_error("not a journal");
+    ActionJournal::Base base;
+    std::u8string map_file(r.u16(), u8'\0');
+    for (auto& c : map_file) c = char8_t(r.u8());
+    base.map_file = map_file;
+    base.tile_width = r.u16();
+    base.tile_height = r.u16();
+    base.tileset = Sc::Terrain::Tileset(r.u16());
+    base.brush = r.u16();
+    base.clutter = r.u16();
+    uint32_t tile_count = r.u32();
+    if (tile_count > r.left() / 2) throw std::runtime_error("journal record too short");
+    base.tiles.resize(tile_count);
+    for (uint16_t& tile : base.tiles) tile = r.u16();
+    return base;
+  }
+
+  std::vector<uint8_t> read_file(const std::filesystem::path& path, size_t offset = 0) {
+    std::ifstream f(path, std::ios::binary);
+    f.seekg(offset);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  }
+}
+
+ActionJournal::ActionJournal()
+  : path(journal_dir() / (QUuid::createUuid().toString(QUuid::WithoutBraces).toStdWString() + L".journal"))
+  , rewrite_header(encode_base({}))
+  , writer([this] { writerLoop(); })
+{
+}
+
+ActionJournal::~ActionJournal()
+{
+  {
+    std::lock_guard<std::mutex> l(mut);
+    stopping = true;
+  }
+  cv.notify_one();
+  writer.join();
+
+  if (file) fclose(file);
+  if (lock) {
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    lock.reset();
+  }
+}
+
+void ActionJournal::setBase(const Base& base, size_t position)
+{
+  position = std::min(position, records_size);
+  records_size -= position;
+  {
+    std::lock_guard<std::mutex> l(mut);
+    rewrite_header = encode_base(base);
+    // The file is only created once there is something to recover.
+    if (!started) return;
+    // A rewrite that is still pending has not dropped its records yet.
+    rewrite_keep_from = (pending_rewrite ? rewrite_keep_from : 0) + position;
+    pending_rewrite = true;
+  }
+  cv.notify_one();
+}
+
+size_t ActionJournal::position() const
+{
+  return records_size;
+}
+
+void ActionJournal::recordAction(const Action& action)
+{
+  appendAction(Apply, action);
+}
+
+void ActionJournal::recordUndo()
+{
+  append({ Undo });
+}
+
+void ActionJournal::recordRedo()
+{
+  append({ Redo });
+}
+
+void ActionJournal::recordRevert(const Action& action)
+{
+  appendAction(Revert, action);
+}
+
+void ActionJournal::recordReapply(const Action& action)
+{
+  appendAction(Reapply, action);
+}
+
+void ActionJournal::appendAction(Record type, const Action& action)
+{
+  std::vector<uint8_t> payload;
+  JournalWriter w(payload);
+  action.write(w);
+
+  std::vector<uint8_t> record;
+  JournalWriter rw(record);
+  rw.u8(type);
+  rw.u8(uint8_t(action.type()));
+  rw.u32(uint32_t(payload.size()));
+  record.insert(record.end(), payload.begin(), payload.end());
+  append(record);
+}
+
+void ActionJournal::recordStrokeBegin()
+{
+  append({ StrokeBegin });
+}
+
+void ActionJournal::recordStrokeEnd()
+{
+  append({ StrokeEnd });
+}
+
+void ActionJournal::sync()
+{
+  std::unique_lock<std::mutex> l(mut);
+  uint64_t id = ++sync_requested;
+  cv.notify_all();
+  cv.wait(l, [&] { return sync_done >= id; });
+}
+
+void ActionJournal::append(const std::vector<uint8_t>& record)
+{
+  records_size += record.size();
+  {
+    std::lock_guard<std::mutex> l(mut);
+    if (!started) {
+      started = true;
+      rewrite_keep_from = 0;
+      pending_rewrite = true;
+    }
+    pending.insert(pending.end(), record.begin(), record.end());
+  }
+  cv.notify_one();
+}
+
+void ActionJournal::writerLoop()
+{
+  std::unique_lock<std::mutex> l(mut);
+  while (true) {
+    cv.wait(l, [this] { return stopping || pending_rewrite || !pending.empty() || sync_done != sync_requested; });
+    if (!pending_rewrite && pending.empty() && sync_done == sync_requested) break;
+
+    std::vector<uint8_t> data;
+    data.swap(pending);
+    bool is_rewrite = pending_rewrite;
+    pending_rewrite = false;
+    std::vector<uint8_t> header;
+    size_t keep_from = rewrite_keep_from;
+    if (is_rewrite) header = rewrite_header;
+    uint64_t syncing = sync_requested;
+    l.unlock();
+
+    if (is_rewrite) {
+      // Everything from keep_from on, of what was written and of data, goes
+      // after the new header.
+      std::vector<uint8_t> kept;
+      if (file) {
+        fwrite(data.data(), 1, data.size(), file);
+        fclose(file);
+        file = nullptr;
+        kept = read_file(path, file_header_size + keep_from);
+      }
+      else if (keep_from < data.size()) {
+        kept.assign(data.begin() + keep_from, data.end());
+      }
+      data = std::move(header);
+      file_header_size = data.size();
+      data.insert(data.end(), kept.begin(), kept.end());
+
+      if (!lock) {
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+        lock = make_lock(path);
+        if (!lock->tryLock(0)) lock.reset();
+      }
+      if (lock) file = create_file(path);
+    }
+    if (file) {
+      fwrite(data.data(), 1, data.size(), file);
+      fflush(file);
+#ifdef _WIN32
+      _commit(_fileno(file));
+#else
+      fsync(fileno(file));
+#endif
+    }
+
+    l.lock();
+    sync_done = syncing;
+    cv.notify_all();
+    // Give edits made in quick succession a chance to go in one sync.
+    cv.wait_for(l, sync_interval, [this] { return stopping || sync_done != sync_requested; });
+  }
+}
+
+std::vector<std::filesystem::path> ActionJournal::findOrphaned()
+{
+  std::vector<std::filesystem::path> r;
+  std::error_code ec;
+  for (auto& entry : std::filesystem::directory_iterator(journal_dir(), ec)) {
+    if (entry.path().extension() != ".journal") continue;
+    auto lock = make_lock(entry.path());
+    if (lock->tryLock(0)) r.push_back(entry.path());
+  }
+  return r;
+}
+
+std::optional<ActionJournal::Base> ActionJournal::readBase(const std::filesystem::path& path)
+{
+  auto data = read_file(path);
+  try {
+    JournalReader r(data.data(), data.data() + data.size());
+    Base base = decode_base(r);
+    r.u8();
+    return base;
+  }
+  catch (const std::runtime_error&) {
+    return std::nullopt;
+  }
+}
+
+void ActionJournal::replay(const std::filesystem::path& path, UndoManager& undo, const ActionReader& read_action)
+{
+  auto data = read_file(path);
+  const uint8_t* end = data.data() + data.size();
+  JournalReader r(data.data(), end);
+  try {
+    decode_base(r);
+    while (true) {
+      Record record = Record(r.u8());
+      switch (record) {
+      case Undo:
+        undo.undo();
+        break;
+      case Redo:
+        undo.redo();
+        break;
+      case StrokeBegin:
+        undo.beginStroke();
+        break;
+      case StrokeEnd:
+        undo.endStroke();
+        break;
+      case Apply:
+      case Revert:
+      case Reapply: {
+        auto type = ActionType(r.u8());
+        size_t size = r.u32();
+        if (size > r.left()) return;
+        std::vector<uint8_t> payload(size);
+        for (auto& v : payload) v = r.u8();
+        JournalReader pr(payload.data(), payload.data() + payload.size());
+        auto action = read_action(type, pr);
+        if (!action) return;
+        if (record == Apply) undo.applyAction(action);
+        else if (record == Revert) undo.revert(action);
+        else undo.reapply(action);
+        break;
+      }
+      default:
+        return;
+      }
+    }
+  }
+  catch (const std::runtime_error&) {
+    // The end of the journal, or a record cut short by the crash.
+  }
+}
+
+void ActionJournal::remove(const std::filesystem::path& path)
+{
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  std::filesystem::remove(lock_path(path), ec);
+}
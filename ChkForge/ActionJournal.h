@@ -0,0 +1,181 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <MappingCoreLib/Sc.h>
+
+class QLockFile;
+
+namespace ChkForge {
+  class Action;
+  class UndoManager;
+  enum class ActionType : uint8_t;
+
+  // Appends the fields of an action to its journal record, little endian.
+  class JournalWriter {
+  public:
+    explicit JournalWriter(std::vector<uint8_t>& data) : data(data) {}
+
+    void u8(uint8_t v) {
+      data.push_back(v);
+    }
+    void u16(uint16_t v) {
+      u8(uint8_t(v));
+      u8(uint8_t(v >> 8));
+    }
+    void u32(uint32_t v) {
+      u16(uint16_t(v));
+      u16(uint16_t(v >> 16));
+    }
+
+  private:
+    std::vector<uint8_t>& data;
+  };
+
+  // Reads back what JournalWriter wrote. Throws if the record is too short.
+  class JournalReader {
+  public:
+    JournalReader(const uint8_t* begin, const uint8_t* end) : pos(begin), end(end) {}
+
+    uint8_t u8() {
+      if (pos == end) throw std::runtime_error("journal record too short");
+      return *pos++;
+    }
+    uint16_t u16() {
+      uint16_t v = u8();
+      return v | uint16_t(u8()) << 8;
+    }
+    uint32_t u32() {
+      uint32_t v = u16();
+      return v | uint32_t(u16()) << 16;
+    }
+
+    size_t left() const {
+      return end - pos;
+    }
+
+  private:
+    const uint8_t* pos;
+    const uint8_t* end;
+  };
+
+  /**
+
+  Records every action applied to a map, and every undo and redo, in an
+  append-only file, so edits made since the map was last saved can be
+  recovered if ChkForge does not exit cleanly.
+
+  The journal starts from a base, the file the map was loaded from or saved
+  to or the parameters of a new map, and holds only what happened since.
+  Records are written and synced by a background thread, at most once per
+  sync_interval, so a crash loses at most that much editing. Records are not
+  kept in memory once written; a new base rewrites the file from itself. The
+  file is removed when the journal is destroyed, which only happens when a
+  map is closed normally.
+
+  */
+  class ActionJournal {
+  public:
+    struct Base {
+      std::filesystem::path map_file;
+      // Used when map_file is empty.
+      int tile_width = 0;
+      int tile_height = 0;
+      Sc::Terrain::Tileset tileset = Sc::Terrain::Tileset::Badlands;
+      int brush = 0;
+      int clutter = 0;
+      // The terrain the brush filled the new map with, it is random.
+      std::vector<uint16_t> tiles;
+    };
+
+    // Constructs an action from its record, or returns null if the type is
+    // unknown.
+    using ActionReader = std::function<std::shared_ptr<Action>(ActionType type, JournalReader& r)>;
+
+    static constexpr std::chrono::milliseconds sync_interval{ 1000 };
+
+    ActionJournal();
+    ~ActionJournal();
+
+    ActionJournal(const ActionJournal&) = delete;
+    ActionJournal& operator=(const ActionJournal&) = delete;
+
+    // Starts over from a new base, keeping the records from position on,
+    // which were made after the base was taken.
+    void setBase(const Base& base, size_t position = SIZE_MAX);
+    // Where the next record goes, for setBase.
+    size_t position() const;
+
+    void recordAction(const Action& action);
+    void recordUndo();
+    void recordRedo();
+    // An action from before the base was undone or redone, see
+    // UndoManager::setJournalBase.
+    void recordRevert(const Action& action);
+    void recordReapply(const Action& action);
+    void recordStrokeBegin();
+    void recordStrokeEnd();
+
+    // Waits until everything recorded so far is in the file.
+    void sync();
+
+    // Journals left behind by instances that did not exit cleanly.
+    static std::vector<std::filesystem::path> findOrphaned();
+    // The base of a journal file, if it has any records to recover.
+    static std::optional<Base> readBase(const std::filesystem::path& path);
+    // Applies the records of a journal file through undo, stopping at the
+    // first incomplete or unknown one.
+    static void replay(const std::filesystem::path& path, UndoManager& undo, const ActionReader& read_action);
+    static void remove(const std::filesystem::path& path);
+
+  private:
+    enum Record : uint8_t {
+      Undo,
+      Redo,
+      Apply,
+      StrokeBegin,
+      StrokeEnd,
+      Revert,
+      Reapply
+    };
+
+    void appendAction(Record type, const Action& action);
+    void append(const std::vector<uint8_t>& record);
+    void writerLoop();
+
+    std::filesystem::path path;
+    // The size of the records since the base.
+    size_t records_size = 0;
+    bool started = false;
+
+    // Shared with the writer thread.
+    std::mutex mut;
+    std::condition_variable cv;
+    std::vector<uint8_t> pending;
+    // The file is to be started over with this header, followed by its
+    // records and pending from rewrite_keep_from on.
+    bool pending_rewrite = false;
+    std::vector<uint8_t> rewrite_header;
+    size_t rewrite_keep_from = 0;
+    bool stopping = false;
+    uint64_t sync_requested = 0;
+    uint64_t sync_done = 0;
+
+    // Only used by the writer thread.
+    FILE* file = nullptr;
+    size_t file_header_size = 0;
+    std::unique_ptr<QLockFile> lock;
+
+    std::thread writer;
+  };
+}
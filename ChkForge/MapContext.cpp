@@ -2,24 +2,142 @@
 #include "mapview.h"
 
 #include <filesystem>
+#include <future>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <fstream>
+#include <unordered_map>
+#include <QGuiApplication>
 #include <QMessageBox>
+#include <QPointer>
+#include <QSettings>
+#include <QTimer>
 
 #include "terrain.h"
 #include "layers.h"
 #include "PlaceUnitAction.h"
+#include "TileDeltaAction.h"
 
 #include "OpenSave.h"
 
 using namespace ChkForge;
 
+namespace {
+  // Writes a map file from serialized CHK data with MapFile::save, on a copy
+  // of the archive previously at source if there is one. Saving the archive
+  // in place keeps its sounds and other files, whether or not it lists them.
+  // The result is written next to target and renamed over it, so target is
+  // never left half written.
+  // Runs on a worker thread, it touches nothing but its arguments.
+  void write_map_file(const std::string& chk_data, const std::filesystem::path& source, const std::filesystem::path& target)
+  {
+    // MapFile picks the format from the extension.
+    std::filesystem::path tmp = target.parent_path() / target.stem();
+    tmp += ".saving";
+    tmp += target.extension();
+    std::error_code ec;
+    std::filesystem::remove(tmp, ec);
+
+    auto fail = [&](const std::string& what) {
+      std::filesystem::remove(tmp, ec);
+      throw std::runtime_error(what);
+    };
+
+    auto is_archive = [](const std::filesystem::path& path) {
+      return !path.empty() && path.extension() != ".chk";
+    };
+    bool copy_archive = is_archive(source) && is_archive(target) && std::filesystem::exists(source, ec);
+    if (copy_archive) {
+      std::filesystem::copy_file(source, tmp, std::filesystem::copy_options::overwrite_existing, ec);
+      if (ec) fail("Failed to copy " + source.string() + ": " + ec.message());
+    }
+
+    {
+      MapFile snapshot(Sc::Terrain::Tileset::Badlands, 64, 64);
+      if (copy_archive && !snapshot.load(tmp.string())) fail("Failed to read " + source.string());
+      std::istringstream chk_stream(chk_data);
+      if (!snapshot.read(chk_stream)) fail("Failed to read the scenario being saved");
+      if (!snapshot.save(tmp.string())) fail("Failed to write " + tmp.string());
+    }
+
+    std::filesystem::rename(tmp, target, ec);
+    if (ec) fail("Failed to replace " + target.string() + ": " + ec.message());
+  }
+
+  // Drives every open map from one 42ms timer. The games share no mutable
+  // state, so when several maps are running their frames are computed on
+  // separate threads. The tick waits for all of them before returning to the
+  // event loop, so painting and editing never see a game mid-frame.
+  // Maps being edited only animate what their views show, and nothing at all
+  // while the application is inactive; the timer stops until it is activated
+  // again unless a map is being tested.
+  class GameTicker : public QObject
+  {
+  public:
+    std::vector<MapContext*> maps;
+
+    GameTicker() : QObject(QCoreApplication::instance())
+    {
+      connect(&timer, &QTimer::timeout, this, &GameTicker::tick);
+      connect(qApp, &QGuiApplication::applicationStateChanged, this, [this](Qt::ApplicationState state) {
+        if (state == Qt::ApplicationActive && !timer.isActive()) timer.start();
+      });
+      timer.start(42);
+    }
+
+  private:
+    QTimer timer;
+
+    void tick()
+    {
+      bool active = QGuiApplication::applicationState() == Qt::ApplicationActive;
+
+      std::vector<MapContext*> running;
+      std::vector<MapContext*> updating;
+      for (MapContext* map : maps) {
+        bool advance = map->prepare_frame(active);
+        if (advance) running.push_back(map);
+        if (advance || map->is_testing()) updating.push_back(map);
+      }
+
+      if (!active && updating.empty()) {
+        timer.stop();
+        return;
+      }
+
+      std::vector<std::future<void>> frames;
+      for (size_t i = 1; i < running.size(); ++i) {
+        frames.push_back(std::async(std::launch::async, [map = running[i]]() {
+          map->advance_frame();
+        }));
+      }
+      if (!running.empty()) running[0]->advance_frame();
+      for (auto& frame : frames) frame.get();
+
+      for (MapContext* map : updating) map->update();
+    }
+  };
+
+  QPointer<GameTicker> ticker;
+}
+
 MapContext::MapContext()
   : openbw_ui(bwgame::game_player())
 {
-  connect(&update_timer, &QTimer::timeout, this, &MapContext::update);
-  update_timer.start(42);
+  openbw_ui.perf_counters = &perf_counters;
+  openbw_ui.player.funcs().perf_counters = &perf_counters;
+  actions.setJournal(&journal);
+  actions.setMemoryLimit(size_t(QSettings().value("undoMemoryLimit", 64).toUInt()) * 1024 * 1024);
+
+  if (!ticker) ticker = new GameTicker();
+  ticker->maps.push_back(this);
+}
+
+MapContext::~MapContext()
+{
+  finish_save();
+  if (ticker) std::erase(ticker->maps, this);
 }
 
 std::shared_ptr<MapContext> MapContext::create() {
@@ -31,38 +149,75 @@ void MapContext::reset() {
 }
 
 void MapContext::update() {
-  if (!game_paused) {
-    openbw_ui.player.next_frame();
-  }
   current_layer->logicUpdate();
+  emit updated();
 }
 
-void MapContext::new_map(int tileWidth, int tileHeight, Sc::Terrain::Tileset tileset, int brush, int clutter) {
+void MapContext::new_map(int tileWidth, int tileHeight, Sc::Terrain::Tileset tileset, int brush, int clutter, const std::vector<uint16_t>& tiles) {
   chk = std::make_shared<MapFile>(tileset, tileWidth, tileHeight);
-  
-  apply_brush(map_dimensions(), brush, clutter);
+
+  ActionJournal::Base base{ {}, tileWidth, tileHeight, tileset, brush, clutter };
+  if (tiles.size() == size_t(tileWidth) * tileHeight) {
+    for (int y = 0; y != tileHeight; ++y) {
+      for (int x = 0; x != tileWidth; ++x) {
+        chk->layers.setTile(x, y, tiles[size_t(y) * tileWidth + x]);
+      }
+    }
+    base.tiles = tiles;
+  }
+  else {
+    apply_brush(map_dimensions(), brush, clutter);
+    base.tiles.reserve(size_t(tileWidth) * tileHeight);
+    for (int y = 0; y != tileHeight; ++y) {
+      for (int x = 0; x != tileWidth; ++x) {
+        base.tiles.push_back(chk->layers.getTile(x, y));
+      }
+    }
+  }
+  journal.setBase(base);
   chkdraft_to_openbw();
   openbw_ui.set_image_data();
   set_unsaved(true);
 }
 
-bool MapContext::load_map(std::filesystem::path map_file) {
+bool MapContext::load_map(std::filesystem::path map_file, LoadProgress* progress) {
+  auto set_stage = [progress](LoadProgress::Stage stage) {
+    if (!progress) return true;
+    progress->stage = stage;
+    return !progress->cancelled;
+  };
+
   map_file.make_preferred();
+  file_path = map_file;
+  if (!set_stage(LoadProgress::ReadingMap)) return false;
   if (!chk->load(map_file.string())) {
-    QMessageBox::critical(nullptr, QString(), tr("Failed to read the Chk file (chk), not a valid map."));
-    return false;
+    throw std::runtime_error(tr("Failed to read the Chk file (chk), not a valid map.").toStdString());
   }
 
-  chkdraft_to_openbw();
+  // Start reading the tileset and unit grps while the map is being converted
+  // and its regions are created, they are needed as soon as it is drawn.
+  bwgame::global_ui_st.preload_tileset_img((size_t)chk->layers.getTileset());
+  bwgame::a_vector<int> unit_types;
+  for (size_t i = 0; i != chk->layers.numUnits(); ++i) {
+    unit_types.push_back(chk->layers.getUnit(i)->type);
+  }
+  bwgame::global_st.prefetch_unit_grps(unit_types);
+
+  if (!set_stage(LoadProgress::LoadingGame)) return false;
+  // Cancelling while the regions are created takes effect after them.
+  chkdraft_to_openbw([&] { set_stage(LoadProgress::CreatingRegions); });
+  if (!set_stage(LoadProgress::LoadingGraphics)) return false;
   openbw_ui.set_image_data();
+  journal.setBase({ file_path });
   set_unsaved(false);
+  set_stage(LoadProgress::Done);
   return true;
 }
 
 void MapContext::add_view(MapView* view)
 {
   views.insert(view);
-  connect(&update_timer, &QTimer::timeout, view, &MapView::updateSurface);
+  connect(this, &MapContext::updated, view, &MapView::updateSurface);
 }
 
 void MapContext::remove_view(MapView* view)
@@ -165,8 +320,41 @@ void MapContext::apply_brush(const QRect& rect, int tileGroup, int clutter)
   }
 }
 
-std::unordered_set<bwgame::unit_t*> MapContext::find_units(bwgame::rect rect) {
-  return unit_finder.find(rect.from.x, rect.from.y, rect.to.x, rect.to.y);
+void MapContext::paint_terrain(const QRect& rect, int tileGroup, int clutter)
+{
+  // apply_brush also reads the tiles next to the rect, but only writes inside it.
+  QRect clip = rect.intersected(map_dimensions());
+  if (clip.isEmpty()) return;
+
+  std::vector<uint16_t> before;
+  before.reserve(size_t(clip.width()) * clip.height());
+  for (int y = clip.top(); y <= clip.bottom(); ++y) {
+    for (int x = clip.left(); x <= clip.right(); ++x) {
+      before.push_back(chk->layers.getTile(x, y));
+    }
+  }
+
+  apply_brush(clip, tileGroup, clutter);
+
+  TileDelta delta;
+  auto old_tile = before.begin();
+  for (int y = clip.top(); y <= clip.bottom(); ++y) {
+    for (int x = clip.left(); x <= clip.right(); ++x, ++old_tile) {
+      uint16_t new_tile = chk->layers.getTile(x, y);
+      if (new_tile != *old_tile) delta.add(y * tile_width() + x, *old_tile, new_tile);
+    }
+  }
+  if (delta.empty()) return;
+
+  // The brush already changed the tiles, applying the action sets them again
+  // and brings OpenBW up to date.
+  actions.applyAction(std::make_shared<TileDeltaAction>(this, std::move(delta)));
+  emit triggerUndoRedoChanged();
+}
+
+const std::vector<bwgame::unit_t*>& MapContext::find_units(bwgame::rect rect) {
+  unit_finder.find(rect.from.x, rect.from.y, rect.to.x, rect.to.y, found_units);
+  return found_units;
 }
 
 void MapContext::select_all() {
@@ -182,6 +370,7 @@ bool MapContext::is_unsaved() {
 
 void MapContext::set_unsaved(bool needs_saving) {
   this->has_unsaved_changes = needs_saving;
+  if (needs_saving && save_task.valid()) edited_while_saving = true;
 
   for (MapView* view : this->views) {
     view->updateTitle();
@@ -190,27 +379,92 @@ void MapContext::set_unsaved(bool needs_saving) {
 
 
 bool MapContext::save() {
-  std::filesystem::path path = chk->getFilePath();
+  std::filesystem::path path = filepath();
   if (path.empty()) {
     path = OpenSave::getMapSaveFilename();
   }
   return saveAs(path);
 }
 
+void MapContext::recover(const std::filesystem::path& journal_file) {
+  ActionJournal::replay(journal_file, actions, [this](ActionType type, JournalReader& r) -> std::shared_ptr<Action> {
+    switch (type) {
+    case ActionType::PlaceUnit:
+      return PlaceUnitAction::read(this, r);
+    case ActionType::PlaceUnits:
+      return PlaceUnitsAction::read(this, r);
+    case ActionType::RemoveUnits:
+      return RemoveUnitsAction::read(this, r);
+    case ActionType::TileDelta:
+      return TileDeltaAction::read(this, r);
+    }
+    return nullptr;
+  });
+  ActionJournal::remove(journal_file);
+  set_unsaved(true);
+}
+
 bool MapContext::saveAs(std::filesystem::path filename) {
+  if (filename.empty()) return false;
   filename.make_preferred();
-  bool result = chk->save(filename.string());
-  if (result) this->has_unsaved_changes = false;
-  return result;
+  finish_save();
+
+  // Only serializing the scenario has to happen here, the rest works on a
+  // copy of the data while editing goes on. Every section is serialized:
+  // edits reach the scenario from dialogs and plugins as well as from
+  // actions, so there is no telling which sections are unchanged.
+  std::stringstream chk_stream;
+  chk->write(chk_stream);
+  std::string chk_data = chk_stream.str();
+
+  if (filename == file_path && chk_data == saved_chk_data) {
+    set_unsaved(false);
+    return true;
+  }
+
+  save_file_path = filename;
+  edited_while_saving = false;
+  save_journal_position = journal.position();
+  // From here on, undoing what is being saved is journaled as reverting it.
+  // That replays the same on either base, so it holds if the save fails.
+  actions.setJournalBase(actions.mark());
+  save_task = std::async(std::launch::async, [this, chk_data = std::move(chk_data), source = file_path, filename]() mutable {
+    write_map_file(chk_data, source, filename);
+    saved_chk_data.swap(chk_data);
+    // The destructor waits for the save, so this is never posted to a
+    // deleted context; posted calls are dropped along with it.
+    QMetaObject::invokeMethod(this, [this] { finish_save(); }, Qt::QueuedConnection);
+  });
+  return true;
+}
+
+bool MapContext::finish_save() {
+  if (!save_task.valid()) return true;
+  try {
+    save_task.get();
+    file_path = save_file_path;
+    // Edits made while the map was being written stay in the journal.
+    journal.setBase({ file_path }, save_journal_position);
+    set_unsaved(edited_while_saving);
+    return true;
+  }
+  catch (const std::exception& e) {
+    saved_chk_data.clear();
+    set_unsaved(true);
+    QMessageBox::critical(nullptr, QString(), tr("Failed to save %1:\n%2").arg(QString::fromStdString(save_file_path.string()), QString::fromStdString(e.what())));
+    return false;
+  }
 }
 
 std::string MapContext::filename()
 {
+  if (!file_path.empty()) return file_path.filename().string();
   return chk->getFileName();
 }
 
 std::string MapContext::filepath()
 {
+  if (!file_path.empty()) return file_path.string();
   return chk->getFilePath();
 }
 
@@ -276,6 +530,10 @@ void MapContext::set_layer_unit_type(Sc::Unit::Type type)
 {
   layer_unit->setPlacementUnitType(type);
 }
+void MapContext::set_layer_terrain_brush(int tileGroup)
+{
+  layer_terrain->setBrush(tileGroup);
+}
 void MapContext::set_layer_sprite_type(Sc::Sprite::Type type)
 {
   layer_sprite->setPlacementSpriteType(type);
@@ -291,6 +549,45 @@ void MapContext::placeUnit(int x, int y, Sc::Unit::Type type, int player)
   emit triggerUndoRedoChanged();
 }
 
+void MapContext::placeUnits(std::vector<PlaceUnitsAction::Unit> units)
+{
+  if (units.empty()) return;
+  actions.applyAction(std::make_shared<PlaceUnitsAction>(this, std::move(units)));
+  emit triggerUndoRedoChanged();
+}
+
+void MapContext::removeUnits(const std::vector<bwgame::unit_t*>& units)
+{
+  // OpenBW units don't know their chk unit, so it is the first one in the
+  // unit list with the same position, type and owner.
+  auto key = [](int x, int y, int type, int owner) {
+    return uint64_t(uint16_t(x)) | uint64_t(uint16_t(y)) << 16 | uint64_t(uint16_t(type)) << 32 | uint64_t(uint8_t(owner)) << 48;
+  };
+  std::unordered_map<uint64_t, size_t> wanted;
+  size_t left = 0;
+  for (bwgame::unit_t* u : units) {
+    if (u == nullptr || u->sprite == nullptr) continue;
+    wanted[key(u->sprite->position.x, u->sprite->position.y, int(u->unit_type->id), u->owner)]++;
+    left++;
+  }
+
+  std::vector<uint32_t> indices;
+  indices.reserve(left);
+  for (size_t i = 0; i != chk->layers.numUnits() && left != 0; ++i) {
+    auto unit = chk->layers.getUnit(i);
+    int owner = unit->owner < Sc::Player::Total ? int(unit->owner) : 0;
+    auto found = wanted.find(key(unit->xc, unit->yc, int(unit->type), owner));
+    if (found == wanted.end() || found->second == 0) continue;
+    found->second--;
+    left--;
+    indices.push_back(uint32_t(i));
+  }
+  if (indices.empty()) return;
+
+  actions.applyAction(std::make_shared<RemoveUnitsAction>(this, std::move(indices)));
+  emit triggerUndoRedoChanged();
+}
+
 void MapContext::start_playback() {
   if (is_testing()) return;
   
@@ -321,6 +618,25 @@ bool MapContext::is_paused() {
   return game_paused;
 }
 
+bool MapContext::prepare_frame(bool app_active) {
+  if (is_testing()) return !game_paused;
+  if (!app_active) return false;
+
+  // Sprites are animated by position, so pad the views to catch large sprites
+  // whose origin is just off screen.
+  edit_frame_areas.clear();
+  for (MapView* view : views) {
+    if (!view->isVisible() || view->isMinimized() || view->visibleRegion().isEmpty()) continue;
+    edit_frame_areas.push_back(toBw(view->getScreenRect().adjusted(-128, -128, 128, 128)));
+  }
+  return !edit_frame_areas.empty();
+}
+
+void MapContext::advance_frame() {
+  if (is_testing()) openbw_ui.player.next_frame();
+  else openbw_ui.player.funcs().next_editor_frame(edit_frame_areas);
+}
+
 bool MapContext::toggle_pause() {
   if (is_testing()) {
     game_paused = !game_paused;
@@ -341,4 +657,35 @@ MapContext::TestState MapContext::get_editor_state() {
 
 bool MapContext::is_testing() {
   return editor_state == MapContext::TestState::Testing;
-}
\ No newline at end of file
+}
+
+void MapContext::set_trigger_profiling(bool enabled) {
+  trigger_profiling = enabled;
+  openbw_ui.player.funcs().trigger_profile = enabled ? &trigger_profile : nullptr;
+}
+
+bool MapContext::is_trigger_profiling() const {
+  return trigger_profiling;
+}
+
+const bwgame::trigger_profile_t& MapContext::get_trigger_profile() const {
+  return trigger_profile;
+}
+
+void MapContext::reset_trigger_profile() {
+  trigger_profile.clear();
+  emit triggerProfileCleared();
+}
+
+bwgame::perf_counters_t& MapContext::get_perf_counters() {
+  return perf_counters;
+}
+
+void MapContext::set_perf_hud_visible(bool visible) {
+  perf_hud_visible = visible;
+  for (MapView* view : views) view->updateSurface();
+}
+
+bool MapContext::is_perf_hud_visible() const {
+  return perf_hud_visible;
+}
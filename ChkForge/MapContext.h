@@ -2,11 +2,14 @@
 #ifndef CHKFORGE_MAPCONTEXT_H
 #define CHKFORGE_MAPCONTEXT_H
 
+#include <atomic>
+#include <future>
 #include <unordered_set>
 #include <random>
 #include <memory>
 #include <vector>
 #include <filesystem>
+#include <functional>
 
 #include <MappingCoreLib/MapFile.h>
 #include <MappingCoreLib/Sc.h>
@@ -16,11 +19,11 @@
 
 #include <QObject>
 #include <QRect>
-#include <QTimer>
 #include <QRgb>
 
 #include "layers.h"
 #include "UndoManager.h"
+#include "PlaceUnitAction.h"
 
 class MapView;
 
@@ -43,15 +46,34 @@ namespace ChkForge
       Testing
     };
 
+    // Progress of load_map, shared with the thread that started it.
+    struct LoadProgress {
+      enum Stage {
+        ReadingMap,
+        LoadingGame,
+        CreatingRegions,
+        LoadingGraphics,
+        Done
+      };
+      std::atomic<int> stage = ReadingMap;
+      std::atomic<bool> cancelled = false;
+    };
+
     MapContext();
+    ~MapContext();
 
     static std::shared_ptr<MapContext> create();
 
     void reset();
     void update();
 
-    void new_map(int tileWidth, int tileHeight, Sc::Terrain::Tileset tileset, int brush, int clutter);
-    bool load_map(std::filesystem::path map_file);
+    // Fills the map with the brush, or with the given tiles if there are
+    // as many as the map has, such as when recovering a new map.
+    void new_map(int tileWidth, int tileHeight, Sc::Terrain::Tileset tileset, int brush, int clutter, const std::vector<uint16_t>& tiles = {});
+    // Safe to call on a worker thread as long as the context has no views
+    // yet. Returns false if cancelled through progress, throws if the map
+    // could not be loaded.
+    bool load_map(std::filesystem::path map_file, LoadProgress* progress = nullptr);
 
     void add_view(MapView* view);
     void remove_view(MapView* view);
@@ -65,16 +87,32 @@ namespace ChkForge
 
     void place_unit(Sc::Unit::Type unitType, int owner, int x, int y);
     void apply_brush(const QRect& rect, int tileGroup, int clutter);
+    // apply_brush as an undoable action, merged with the rest of the stroke.
+    void paint_terrain(const QRect& rect, int tileGroup, int clutter);
 
-    void chkdraft_to_openbw();
+    // regions_started is called when OpenBW starts creating the regions.
+    void chkdraft_to_openbw(std::function<void()> regions_started = {});
+    // Copies the given tiles to OpenBW after they were changed in the chk.
+    void update_openbw_tiles(const QRect& rect);
 
-    std::unordered_set<bwgame::unit_t*> find_units(bwgame::rect rect);
+    // The result is overwritten by the next call.
+    const std::vector<bwgame::unit_t*>& find_units(bwgame::rect rect);
     void select_all();
 
     bool is_unsaved();
     void set_unsaved(bool needs_saving = true);
     bool save();
+    // Applies the edits recorded in a journal left behind by a crash, on top
+    // of the map it was based on, and removes the journal.
+    void recover(const std::filesystem::path& journal_file);
+    // Serializes the map and writes it out on a worker thread, replacing the
+    // file only once it has been written completely. Returns false if the
+    // save could not be started. The map is only marked as saved, and write
+    // errors only reported, when it finishes.
     bool saveAs(std::filesystem::path filename);
+    // Waits for a save started by saveAs and reports its result. Returns
+    // false if it failed.
+    bool finish_save();
     std::string filename();
     std::string filepath();
 
@@ -96,13 +134,25 @@ namespace ChkForge
     void set_player(int player_id);
     int get_player();
     void set_layer_unit_type(Sc::Unit::Type type);
+    void set_layer_terrain_brush(int tileGroup);
     void set_layer_sprite_type(Sc::Sprite::Type type);
     void set_layer_sprite_unit_type(Sc::Unit::Type type);
 
     void placeUnit(int x, int y, Sc::Unit::Type type, int player);
+    // Places all the units as one undoable action.
+    void placeUnits(std::vector<PlaceUnitsAction::Unit> units);
+    // Removes the chk units of all the OpenBW units as one undoable action.
+    void removeUnits(const std::vector<bwgame::unit_t*>& units);
 
     int placeOpenBwUnit(Chk::UnitPtr unit);
     void removeOpenBwUnit(int index);
+    // The same for many units at once, returning their indices; -1 for
+    // units that could not be created.
+    std::vector<int> placeOpenBwUnits(const std::vector<Chk::UnitPtr>& units);
+    void removeOpenBwUnits(const std::vector<int>& indices);
+    // The indices of the placed OpenBW units made from the chk units, found
+    // by position, type and owner; -1 where there is none.
+    std::vector<int> findOpenBwUnits(const std::vector<Chk::UnitPtr>& units);
 
     void start_playback();
     void stop_playback();
@@ -110,13 +160,29 @@ namespace ChkForge
     bool toggle_pause();
     void frame_advance(int num_frames = 1);
 
+    // Used by the editor tick. prepare_frame runs on the GUI thread and returns
+    // whether the game has anything to do this tick; advance_frame may then
+    // run on any thread while the GUI thread waits.
+    bool prepare_frame(bool app_active);
+    void advance_frame();
+
     TestState get_editor_state();
     bool is_testing();
 
+    void set_trigger_profiling(bool enabled);
+    bool is_trigger_profiling() const;
+    const bwgame::trigger_profile_t& get_trigger_profile() const;
+    void reset_trigger_profile();
+
+    bwgame::perf_counters_t& get_perf_counters();
+    void set_perf_hud_visible(bool visible);
+    bool is_perf_hud_visible() const;
+
   public:
     std::shared_ptr<MapFile> chk = std::make_shared<MapFile>(Sc::Terrain::Tileset::Badlands, 64, 64);
     bwgame::ui_functions openbw_ui;
 
+    ActionJournal journal;
     UndoManager actions{ this };
   private:
     // Other stuff/info (i.e. list of views that are holding the map)
@@ -126,11 +192,17 @@ namespace ChkForge
     std::mt19937 random{ rnd_d() };
 
     bool has_unsaved_changes = false;
+    std::filesystem::path file_path;
+    std::filesystem::path save_file_path;
+    std::future<void> save_task;
+    size_t save_journal_position = 0;
+    bool edited_while_saving = false;
+    // CHK data of the last save, the archive is not rebuilt if it is unchanged.
+    std::string saved_chk_data;
     bool game_paused = false;
     TestState editor_state = TestState::Editing;
     Layer_t last_edit_layer = Layer_t::LAYER_SELECT;
-
-    QTimer update_timer{};
+    bwgame::a_vector<bwgame::rect> edit_frame_areas;
 
     std::shared_ptr<SelectLayer> layer_select = std::make_shared<SelectLayer>(this);
     std::shared_ptr<TerrainLayer> layer_terrain = std::make_shared<TerrainLayer>(this);
@@ -156,13 +228,26 @@ namespace ChkForge
 
     int current_player = 0;
 
+    bwgame::trigger_profile_t trigger_profile;
+    bool trigger_profiling = false;
+
+    bwgame::perf_counters_t perf_counters;
+    bool perf_hud_visible = false;
+
     std::unordered_set<bwgame::unit_t*> placed_units;
     std::unordered_set<bwgame::unit_t*> placed_unit_sprites;
     UnitFinder unit_finder;
     UnitFinder unit_sprite_finder;
+    std::vector<bwgame::unit_t*> found_units;
+
+    bwgame::unit_t* createOpenBwUnit(const Chk::Unit& unit);
 
   signals:
     void triggerUndoRedoChanged();
+    // Emitted when the trigger profile is cleared, including on reload.
+    void triggerProfileCleared();
+    // Emitted on every editor tick, after the game has advanced.
+    void updated();
   };
 }
 
@@ -2,16 +2,24 @@
 
 using namespace ChkForge;
 
-void MapContext::chkdraft_to_openbw()
+void MapContext::chkdraft_to_openbw(std::function<void()> regions_started)
 {
+  OPENBW_PERF_SCOPE(&perf_counters, timer_load_map);
+
   openbw_ui.reset();
 
   bwgame::game_load_functions game_load_funcs(openbw_ui.st);
   game_load_funcs.use_map_settings = true;
+  game_load_funcs.perf_counters = &perf_counters;
+  game_load_funcs.regions_create_started = std::move(regions_started);
 
   openbw_ui.is_editor = editor_state == MapContext::TestState::Editing;
   game_load_funcs.st.is_editor_paused = editor_state == MapContext::TestState::Editing;
 
+  // Trigger indices change whenever the map is reloaded
+  trigger_profile.clear();
+  emit triggerProfileCleared();
+
   placed_units.clear();
   unit_finder.clear();
   unit_sprite_finder.clear();
@@ -38,21 +46,51 @@ void MapContext::chkdraft_to_openbw()
   game_load_funcs.load_map_data(reinterpret_cast<unsigned char*>(data.data()), data.size(), {}, !openbw_ui.is_editor, unit_created_cb);
 }
 
-int MapContext::placeOpenBwUnit(Chk::UnitPtr unit) {
+void MapContext::update_openbw_tiles(const QRect& rect)
+{
+  // Same as loading the MTXM section, for the given tiles only.
+  QRect clip = rect.intersected(map_dimensions());
+  bwgame::game_state& game_st = *openbw_ui.st.game;
+  auto& cv5 = openbw_ui.cv5();
+  for (int y = clip.top(); y <= clip.bottom(); ++y) {
+    for (int x = clip.left(); x <= clip.right(); ++x) {
+      size_t index = size_t(y) * game_st.map_tile_width + x;
+      bwgame::tile_id tile_id(chk->layers.getTile(x, y));
+      game_st.gfx_tiles.at(index) = tile_id;
+      if (tile_id.group_index() >= cv5.size()) tile_id = {};
+      size_t megatile_index = cv5.at(tile_id.group_index()).mega_tile_index[tile_id.subtile_index()];
+      int cv5_flags = cv5.at(tile_id.group_index()).flags & ~(bwgame::tile_t::flag_walkable | bwgame::tile_t::flag_unwalkable | bwgame::tile_t::flag_very_high | bwgame::tile_t::flag_middle | bwgame::tile_t::flag_high | bwgame::tile_t::flag_partially_walkable);
+      openbw_ui.st.tiles_mega_tile_index[index] = (uint16_t)megatile_index;
+      openbw_ui.st.tiles[index].flags = openbw_ui.mega_tile_flags().at(megatile_index) | cv5_flags;
+      if (tile_id.has_creep()) {
+        openbw_ui.st.tiles_mega_tile_index[index] |= 0x8000;
+        openbw_ui.st.tiles[index].flags |= bwgame::tile_t::flag_has_creep;
+      }
+      openbw_ui.st.creep_bitmap.set(x, y, tile_id.has_creep());
+    }
+  }
+}
 
-  int type = unit->type;
-  int owner = unit->owner;
+bwgame::unit_t* MapContext::createOpenBwUnit(const Chk::Unit& unit) {
 
-  if (type >= Sc::Unit::TotalTypes) return -1;
+  int type = unit.type;
+  int owner = unit.owner;
+
+  if (type >= Sc::Unit::TotalTypes) return nullptr;
   if (owner >= Sc::Player::Total) owner = 0;
 
   const bwgame::unit_type_t* obw_unit_type = openbw_ui.get_unit_type(bwgame::UnitTypes(type));
 
-  bwgame::unit_t* new_unit = openbw_ui.create_editor_unit(obw_unit_type, { unit->xc, unit->yc }, owner);
+  bwgame::unit_t* new_unit = openbw_ui.create_editor_unit(obw_unit_type, { unit.xc, unit.yc }, owner);
   if (new_unit == nullptr) {
-    bwgame::warn("Failed to create unit type %d at (%d, %d)", type, unit->xc, unit->yc);
-    return -1;
+    bwgame::warn("Failed to create unit type %d at (%d, %d)", type, unit.xc, unit.yc);
   }
+  return new_unit;
+}
+
+int MapContext::placeOpenBwUnit(Chk::UnitPtr unit) {
+  bwgame::unit_t* new_unit = createOpenBwUnit(*unit);
+  if (new_unit == nullptr) return -1;
 
   placed_units.insert(new_unit);
   unit_finder.add(new_unit);
@@ -60,6 +98,25 @@ int MapContext::placeOpenBwUnit(Chk::UnitPtr unit) {
   return new_unit->index;
 }
 
+std::vector<int> MapContext::placeOpenBwUnits(const std::vector<Chk::UnitPtr>& units) {
+  std::vector<int> indices;
+  indices.reserve(units.size());
+  std::vector<bwgame::unit_t*> new_units;
+  new_units.reserve(units.size());
+  placed_units.reserve(placed_units.size() + units.size());
+
+  for (const Chk::UnitPtr& unit : units) {
+    bwgame::unit_t* new_unit = createOpenBwUnit(*unit);
+    indices.push_back(new_unit ? int(new_unit->index) : -1);
+    if (new_unit == nullptr) continue;
+    placed_units.insert(new_unit);
+    new_units.push_back(new_unit);
+  }
+  unit_finder.add(new_units);
+
+  return indices;
+}
+
 void MapContext::removeOpenBwUnit(int index)
 {
   auto to_remove = openbw_ui.get_unit(index);
@@ -70,3 +127,46 @@ void MapContext::removeOpenBwUnit(int index)
   placed_unit_sprites.erase(to_remove);
   openbw_ui.remove_unit(to_remove);
 }
+
+void MapContext::removeOpenBwUnits(const std::vector<int>& indices)
+{
+  std::vector<bwgame::unit_t*> to_remove;
+  to_remove.reserve(indices.size());
+  for (int index : indices) {
+    if (index == -1) continue;
+    bwgame::unit_t* u = openbw_ui.get_unit(index);
+    if (u != nullptr) to_remove.push_back(u);
+  }
+
+  // Take them out of the finder in one go, before their sprites are gone.
+  unit_finder.remove(to_remove);
+  for (bwgame::unit_t* u : to_remove) {
+    placed_units.erase(u);
+    placed_unit_sprites.erase(u);
+    openbw_ui.remove_unit(u);
+  }
+}
+
+std::vector<int> MapContext::findOpenBwUnits(const std::vector<Chk::UnitPtr>& units)
+{
+  std::vector<int> indices;
+  indices.reserve(units.size());
+  // Stacked units look the same, each is only found once.
+  std::unordered_set<bwgame::unit_t*> taken;
+  std::vector<bwgame::unit_t*> found;
+  for (const Chk::UnitPtr& unit : units) {
+    int type = unit->type;
+    int owner = unit->owner < Sc::Player::Total ? int(unit->owner) : 0;
+    int index = -1;
+    unit_finder.find(unit->xc, unit->yc, unit->xc, unit->yc, found);
+    for (bwgame::unit_t* u : found) {
+      if (u->sprite->position.x != unit->xc || u->sprite->position.y != unit->yc) continue;
+      if (int(u->unit_type->id) != type || u->owner != owner) continue;
+      if (!placed_units.count(u) || !taken.insert(u).second) continue;
+      index = int(u->index);
+      break;
+    }
+    indices.push_back(index);
+  }
+  return indices;
+}
@@ -1,26 +1,34 @@
 #include "PlaceUnitAction.h"
 #include "MapContext.h"
+#include "ActionJournal.h"
 
 using namespace ChkForge;
 
+namespace {
+  Chk::UnitPtr make_unit(int x, int y, Sc::Unit::Type unitType, int owner) {
+    auto unit = std::make_shared<Chk::Unit>();
+    unit->classId = 0;
+    unit->xc = x;
+    unit->yc = y;
+    unit->type = unitType;
+    unit->relationFlags = 0;
+    unit->validStateFlags = 0xFFFF;
+    unit->validFieldFlags = 0xFFFF;
+    unit->owner = owner;
+    unit->hitpointPercent = 100;
+    unit->shieldPercent = 100;
+    unit->energyPercent = 100;
+    unit->resourceAmount = 0;
+    unit->hangerAmount = 0;
+    unit->stateFlags = 0;
+    unit->unused = 0;
+    unit->relationClassId = 0;
+    return unit;
+  }
+}
+
 void PlaceUnitAction::apply() {
-  auto unit = std::make_shared<Chk::Unit>();
-  unit->classId = 0;
-  unit->xc = x;
-  unit->yc = y;
-  unit->type = unitType;
-  unit->relationFlags = 0;
-  unit->validStateFlags = 0xFFFF;
-  unit->validFieldFlags = 0xFFFF;
-  unit->owner = owner;
-  unit->hitpointPercent = 100;
-  unit->shieldPercent = 100;
-  unit->energyPercent = 100;
-  unit->resourceAmount = 0;
-  unit->hangerAmount = 0;
-  unit->stateFlags = 0;
-  unit->unused = 0;
-  unit->relationClassId = 0;
+  auto unit = make_unit(x, y, unitType, owner);
 
   this->chkDraftIndex = map->chk->layers.addUnit(unit);
   // TODO: index will get shuffled when units are deleted in OpenBW
@@ -37,3 +45,115 @@ void PlaceUnitAction::undo() {
 
 }
 
+void PlaceUnitAction::write(JournalWriter& w) const {
+  w.u16(uint16_t(x));
+  w.u16(uint16_t(y));
+  w.u16(uint16_t(unitType));
+  w.u8(uint8_t(owner));
+}
+
+std::shared_ptr<PlaceUnitAction> PlaceUnitAction::read(MapContext* map, JournalReader& r) {
+  int x = r.u16();
+  int y = r.u16();
+  auto unitType = Sc::Unit::Type(r.u16());
+  int owner = r.u8();
+  return std::make_shared<PlaceUnitAction>(map, x, y, unitType, owner);
+}
+
+void PlaceUnitsAction::apply() {
+  // MappingCoreLib only adds chk units one at a time, its unit list can't be
+  // reserved from here.
+  std::vector<Chk::UnitPtr> chk_units;
+  chk_units.reserve(units.size());
+  chkDraftIndices.clear();
+  chkDraftIndices.reserve(units.size());
+  for (const Unit& u : units) {
+    chk_units.push_back(make_unit(u.x, u.y, u.type, u.owner));
+    chkDraftIndices.push_back(int(map->chk->layers.addUnit(chk_units.back())));
+  }
+  openbwIndices = map->placeOpenBwUnits(chk_units);
+}
+
+void PlaceUnitsAction::undo() {
+  // Newest first, so the earlier indices stay valid.
+  for (auto i = chkDraftIndices.rbegin(); i != chkDraftIndices.rend(); ++i) {
+    if (*i != -1) map->chk->layers.deleteUnit(*i);
+  }
+  map->removeOpenBwUnits(openbwIndices);
+  chkDraftIndices.clear();
+  openbwIndices.clear();
+}
+
+size_t PlaceUnitsAction::memoryUsage() const {
+  return sizeof(*this) + units.capacity() * sizeof(Unit) + (chkDraftIndices.capacity() + openbwIndices.capacity()) * sizeof(int);
+}
+
+void PlaceUnitsAction::write(JournalWriter& w) const {
+  w.u32(uint32_t(units.size()));
+  for (const Unit& u : units) {
+    w.u16(u.x);
+    w.u16(u.y);
+    w.u16(uint16_t(u.type));
+    w.u8(u.owner);
+  }
+}
+
+std::shared_ptr<PlaceUnitsAction> PlaceUnitsAction::read(MapContext* map, JournalReader& r) {
+  uint32_t count = r.u32();
+  if (count > r.left() / 7) throw std::runtime_error("journal record too short");
+  std::vector<Unit> units(count);
+  for (Unit& u : units) {
+    u.x = r.u16();
+    u.y = r.u16();
+    u.type = Sc::Unit::Type(r.u16());
+    u.owner = r.u8();
+  }
+  return std::make_shared<PlaceUnitsAction>(map, std::move(units));
+}
+
+void RemoveUnitsAction::apply() {
+  units.clear();
+  units.reserve(chkDraftIndices.size());
+  for (uint32_t i : chkDraftIndices) {
+    units.push_back(map->chk->layers.getUnit(i));
+  }
+  std::vector<int> openbw_indices = map->findOpenBwUnits(units);
+
+  // Newest first, so the earlier indices stay valid.
+  for (auto i = chkDraftIndices.rbegin(); i != chkDraftIndices.rend(); ++i) {
+    map->chk->layers.deleteUnit(*i);
+  }
+  map->removeOpenBwUnits(openbw_indices);
+}
+
+void RemoveUnitsAction::undo() {
+  // Oldest first, so every unit goes back where it was.
+  for (size_t i = 0; i != units.size(); ++i) {
+    map->chk->layers.insertUnit(chkDraftIndices[i], units[i]);
+  }
+  map->placeOpenBwUnits(units);
+  units.clear();
+}
+
+size_t RemoveUnitsAction::memoryUsage() const {
+  return sizeof(*this) + chkDraftIndices.capacity() * sizeof(uint32_t) + units.capacity() * sizeof(Chk::UnitPtr) + units.size() * sizeof(Chk::Unit);
+}
+
+void RemoveUnitsAction::write(JournalWriter& w) const {
+  w.u32(uint32_t(chkDraftIndices.size()));
+  for (uint32_t i : chkDraftIndices) {
+    w.u32(i);
+  }
+}
+
+std::shared_ptr<RemoveUnitsAction> RemoveUnitsAction::read(MapContext* map, JournalReader& r) {
+  uint32_t count = r.u32();
+  if (count > r.left() / 4) throw std::runtime_error("journal record too short");
+  std::vector<uint32_t> indices(count);
+  for (size_t i = 0; i != count; ++i) {
+    indices[i] = r.u32();
+    if (i != 0 && indices[i] <= indices[i - 1]) throw std::runtime_error("journal unit indices out of order");
+  }
+  return std::make_shared<RemoveUnitsAction>(map, std::move(indices));
+}
+
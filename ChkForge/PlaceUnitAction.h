@@ -1,7 +1,14 @@
 #pragma once
 #include "Action.h"
+#include <memory>
+#include <vector>
+#include <MappingCoreLib/Chk.h>
 #include <MappingCoreLib/Sc.h>
 
+namespace ChkForge {
+  class JournalReader;
+}
+
 namespace ChkForge {
   class PlaceUnitAction : public Action {
   public:
@@ -15,6 +22,11 @@ namespace ChkForge {
 
     virtual void apply() override;
     virtual void undo() override;
+    virtual size_t memoryUsage() const override { return sizeof(*this); }
+
+    virtual ActionType type() const override { return ActionType::PlaceUnit; }
+    virtual void write(JournalWriter& w) const override;
+    static std::shared_ptr<PlaceUnitAction> read(MapContext* map, JournalReader& r);
   private:
     int owner;
     Sc::Unit::Type unitType;
@@ -22,4 +34,57 @@ namespace ChkForge {
     int chkDraftIndex = -1;
     int openbwIndex = -1;
   };
+
+  // Places many units as one action, creating their OpenBW units in one pass
+  // and updating the unit finder once.
+  class PlaceUnitsAction : public Action {
+  public:
+    struct Unit {
+      uint16_t x, y;
+      Sc::Unit::Type type;
+      uint8_t owner;
+    };
+
+    PlaceUnitsAction(MapContext* map, std::vector<Unit> units)
+      : Action(map)
+      , units(std::move(units))
+    {}
+    virtual ~PlaceUnitsAction() {}
+
+    virtual void apply() override;
+    virtual void undo() override;
+    virtual size_t memoryUsage() const override;
+
+    virtual ActionType type() const override { return ActionType::PlaceUnits; }
+    virtual void write(JournalWriter& w) const override;
+    static std::shared_ptr<PlaceUnitsAction> read(MapContext* map, JournalReader& r);
+  private:
+    std::vector<Unit> units;
+    std::vector<int> chkDraftIndices;
+    std::vector<int> openbwIndices;
+  };
+
+  // Removes many units as one action, by their indices in the chk unit list,
+  // taking their OpenBW units out of the map and the unit finder at once.
+  class RemoveUnitsAction : public Action {
+  public:
+    // The indices must be in increasing order.
+    RemoveUnitsAction(MapContext* map, std::vector<uint32_t> chkDraftIndices)
+      : Action(map)
+      , chkDraftIndices(std::move(chkDraftIndices))
+    {}
+    virtual ~RemoveUnitsAction() {}
+
+    virtual void apply() override;
+    virtual void undo() override;
+    virtual size_t memoryUsage() const override;
+
+    virtual ActionType type() const override { return ActionType::RemoveUnits; }
+    virtual void write(JournalWriter& w) const override;
+    static std::shared_ptr<RemoveUnitsAction> read(MapContext* map, JournalReader& r);
+  private:
+    std::vector<uint32_t> chkDraftIndices;
+    // What was removed, to be put back at the same indices when undoing.
+    std::vector<Chk::UnitPtr> units;
+  };
 }
\ No newline at end of file
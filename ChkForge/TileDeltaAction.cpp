@@ -0,0 +1,159 @@
+#include "TileDeltaAction.h"
+#include "MapContext.h"
+#include "ActionJournal.h"
+#include <algorithm>
+
+using namespace ChkForge;
+
+void TileDelta::add(uint32_t index, uint16_t old_tile, uint16_t new_tile) {
+  if (!runs.empty() && runs.back().start + runs.back().length == index) {
+    runs.back().length++;
+  }
+  else {
+    runs.push_back({ index, 1 });
+  }
+  old_tiles.push_back(old_tile);
+  new_tiles.push_back(new_tile);
+}
+
+void TileDelta::merge(const TileDelta& later) {
+  // A stroke merges many small deltas into a large one, so this only touches
+  // the tiles of the later delta.
+  if (slots.empty()) {
+    slots.reserve(old_tiles.size());
+    uint32_t tile = 0;
+    for (const Run& run : runs) {
+      for (uint32_t i = run.start; i != run.start + run.length; ++i) {
+        slots.emplace(i, tile++);
+      }
+    }
+  }
+  size_t tile = 0;
+  for (const Run& run : later.runs) {
+    for (uint32_t i = run.start; i != run.start + run.length; ++i, ++tile) {
+      auto [slot, added] = slots.try_emplace(i, uint32_t(new_tiles.size()));
+      if (added) add(i, later.old_tiles[tile], later.new_tiles[tile]);
+      else new_tiles[slot->second] = later.new_tiles[tile];
+    }
+  }
+}
+
+void TileDelta::compact() {
+  slots = {};
+  auto by_start = [](const Run& a, const Run& b) { return a.start < b.start; };
+  if (!std::is_sorted(runs.begin(), runs.end(), by_start)) {
+    // Where each run's tiles start, to find them again once sorted.
+    std::vector<std::pair<Run, size_t>> order;
+    order.reserve(runs.size());
+    size_t tile = 0;
+    for (const Run& run : runs) {
+      order.push_back({ run, tile });
+      tile += run.length;
+    }
+    std::sort(order.begin(), order.end(), [&](const auto& a, const auto& b) { return by_start(a.first, b.first); });
+
+    TileDelta r;
+    r.runs.reserve(runs.size());
+    r.old_tiles.reserve(old_tiles.size());
+    r.new_tiles.reserve(new_tiles.size());
+    for (const auto& [run, first] : order) {
+      for (uint32_t i = 0; i != run.length; ++i) {
+        r.add(run.start + i, old_tiles[first + i], new_tiles[first + i]);
+      }
+    }
+    *this = std::move(r);
+  }
+  runs.shrink_to_fit();
+  old_tiles.shrink_to_fit();
+  new_tiles.shrink_to_fit();
+}
+
+size_t TileDelta::memoryUsage() const {
+  // Each slot is a node holding the pair and a next pointer, plus a bucket.
+  size_t slots_usage = slots.size() * (sizeof(std::pair<uint32_t, uint32_t>) + sizeof(void*)) + slots.bucket_count() * sizeof(void*);
+  return sizeof(*this) + runs.capacity() * sizeof(Run) + (old_tiles.capacity() + new_tiles.capacity()) * sizeof(uint16_t) + slots_usage;
+}
+
+QRect TileDelta::bounds(int map_width) const {
+  QRect r;
+  for (const Run& run : runs) {
+    int y = run.start / map_width;
+    int x = run.start % map_width;
+    int end_y = (run.start + run.length - 1) / map_width;
+    if (end_y != y) r |= QRect(0, y, map_width, end_y - y + 1);
+    else r |= QRect(x, y, run.length, 1);
+  }
+  return r;
+}
+
+void TileDelta::apply(MapContext* map, bool undo) const {
+  const std::vector<uint16_t>& tiles = undo ? old_tiles : new_tiles;
+  int map_width = map->tile_width();
+  size_t tile = 0;
+  for (const Run& run : runs) {
+    for (uint32_t i = run.start; i != run.start + run.length; ++i) {
+      map->chk->layers.setTile(i % map_width, i / map_width, tiles[tile++]);
+    }
+  }
+  map->update_openbw_tiles(bounds(map_width));
+}
+
+void TileDelta::write(JournalWriter& w) const {
+  w.u32(uint32_t(runs.size()));
+  for (const Run& run : runs) {
+    w.u32(run.start);
+    w.u32(run.length);
+  }
+  for (size_t i = 0; i != new_tiles.size(); ++i) {
+    w.u16(old_tiles[i]);
+    w.u16(new_tiles[i]);
+  }
+}
+
+TileDelta TileDelta::read(JournalReader& r) {
+  TileDelta delta;
+  uint32_t run_count = r.u32();
+  if (run_count > r.left() / 8) throw std::runtime_error("journal record too short");
+  std::vector<Run> runs(run_count);
+  for (Run& run : runs) {
+    run.start = r.u32();
+    run.length = r.u32();
+  }
+  for (const Run& run : runs) {
+    for (uint32_t i = run.start; i != run.start + run.length; ++i) {
+      uint16_t old_tile = r.u16();
+      delta.add(i, old_tile, r.u16());
+    }
+  }
+  return delta;
+}
+
+void TileDeltaAction::apply() {
+  delta.apply(map, false);
+}
+
+void TileDeltaAction::undo() {
+  delta.apply(map, true);
+}
+
+bool TileDeltaAction::merge(const Action& next) {
+  if (next.type() != ActionType::TileDelta) return false;
+  delta.merge(static_cast<const TileDeltaAction&>(next).delta);
+  return true;
+}
+
+void TileDeltaAction::compact() {
+  delta.compact();
+}
+
+size_t TileDeltaAction::memoryUsage() const {
+  return sizeof(*this) - sizeof(delta) + delta.memoryUsage();
+}
+
+void TileDeltaAction::write(JournalWriter& w) const {
+  delta.write(w);
+}
+
+std::shared_ptr<TileDeltaAction> TileDeltaAction::read(MapContext* map, JournalReader& r) {
+  return std::make_shared<TileDeltaAction>(map, TileDelta::read(r));
+}
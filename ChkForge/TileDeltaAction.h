@@ -0,0 +1,70 @@
+#pragma once
+#include "Action.h"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <QRect>
+
+namespace ChkForge {
+  class JournalReader;
+
+  // Tiles changed by an edit, as runs of consecutive tile indices with the
+  // values they had before and after.
+  class TileDelta {
+  public:
+    // Indices must be added in increasing order.
+    void add(uint32_t index, uint16_t old_tile, uint16_t new_tile);
+    // Combines this with a delta made after it; tiles changed by both keep
+    // their old value from this one and their new value from the later one.
+    // Tiles new to this delta are appended, so runs may be out of order until
+    // compact is called.
+    void merge(const TileDelta& later);
+    // Sorts and joins the runs and frees what merging needed.
+    void compact();
+
+    bool empty() const { return runs.empty(); }
+    size_t memoryUsage() const;
+    QRect bounds(int map_width) const;
+
+    // Sets the new tiles, or the old ones when undoing.
+    void apply(MapContext* map, bool undo) const;
+
+    void write(JournalWriter& w) const;
+    static TileDelta read(JournalReader& r);
+
+  private:
+    struct Run {
+      uint32_t start;
+      uint32_t length;
+    };
+    std::vector<Run> runs;
+    std::vector<uint16_t> old_tiles;
+    std::vector<uint16_t> new_tiles;
+    // Where each tile index is in old_tiles and new_tiles, kept from the
+    // first merge until compact.
+    std::unordered_map<uint32_t, uint32_t> slots;
+  };
+
+  class TileDeltaAction : public Action {
+  public:
+    TileDeltaAction(MapContext* map, TileDelta delta)
+      : Action(map)
+      , delta(std::move(delta))
+    {}
+    virtual ~TileDeltaAction() {}
+
+    virtual void apply() override;
+    virtual void undo() override;
+
+    virtual bool merge(const Action& next) override;
+    virtual void compact() override;
+    virtual size_t memoryUsage() const override;
+
+    virtual ActionType type() const override { return ActionType::TileDelta; }
+    virtual void write(JournalWriter& w) const override;
+    static std::shared_ptr<TileDeltaAction> read(MapContext* map, JournalReader& r);
+  private:
+    TileDelta delta;
+  };
+}
@@ -1,7 +1,9 @@
 #pragma once
-#include <vector>
+#include <cstdint>
+#include <deque>
 #include <memory>
 #include "Action.h"
+#include "ActionJournal.h"
 
 namespace ChkForge {
   class MapContext;
@@ -10,19 +12,86 @@ namespace ChkForge {
   public:
     UndoManager(MapContext* map) : map(map) {}
 
+    // Every action, undo and redo is recorded in the journal, if set.
+    void setJournal(ActionJournal* journal) {
+      this->journal = journal;
+    }
+
+    // The oldest actions are dropped once the history takes more memory than
+    // this; the last action is always kept.
+    void setMemoryLimit(size_t bytes) {
+      memory_limit = bytes;
+      evict();
+    }
+
+    size_t memoryUsage() const {
+      return memory_used;
+    }
+
+    // Identifies the history as it is now, for setJournalBase.
+    uint64_t mark() const {
+      return next_serial;
+    }
+
+    // Tells the history that the map was saved at mark, so the journal will
+    // be rebased on it and have no record of the actions from before. Undoing
+    // or redoing one of them is then journaled as the action itself, reverted
+    // or reapplied directly on replay, instead of as a step through the
+    // history.
+    void setJournalBase(uint64_t mark) {
+      journal_base = mark;
+    }
+
+    // Actions applied between beginStroke and endStroke, such as while the
+    // mouse is held down painting, are merged into one undo step where they
+    // allow it.
+    void beginStroke() {
+      in_stroke = true;
+      stopMerging();
+      if (journal) journal->recordStrokeBegin();
+    }
+
+    void endStroke() {
+      in_stroke = false;
+      stopMerging();
+      if (journal) journal->recordStrokeEnd();
+    }
+
     void addAction(std::shared_ptr<Action> action) {
-      actions.erase(actions.begin() + index, actions.end());
-      actions.push_back(action);
+      while (actions.size() > index) {
+        memory_used -= actions.back().action->memoryUsage();
+        actions.pop_back();
+      }
+
+      if (can_merge && !actions.empty() && actions.back().serial >= journal_base) {
+        Action& last = *actions.back().action;
+        size_t last_usage = last.memoryUsage();
+        if (last.merge(*action)) {
+          memory_used = memory_used - last_usage + last.memoryUsage();
+          evict();
+          return;
+        }
+      }
+
+      stopMerging();
+      memory_used += action->memoryUsage();
+      actions.push_back({ action, next_serial++ });
       index = actions.size();
+      can_merge = in_stroke;
+      evict();
     }
 
-    template <class T, typename... Args>
-    void applyAction(Args... args) {
-      auto action = std::make_shared<T>(map, args...);
+    void applyAction(std::shared_ptr<Action> action) {
       action->apply();
+      if (journal) journal->recordAction(*action);
       addAction(action);
     }
 
+    template <class T, typename... Args>
+    void applyAction(Args... args) {
+      applyAction(std::make_shared<T>(map, args...));
+    }
+
     bool hasUndo() {
       return !actions.empty() && index > 0;
     }
@@ -33,19 +102,77 @@ namespace ChkForge {
 
     void undo() {
       if (!hasUndo()) return;
+      stopMerging();
       index--;
-      actions.at(index)->undo();
+      Entry& entry = actions.at(index);
+      entry.action->undo();
+      if (!journal) return;
+      if (entry.serial < journal_base) journal->recordRevert(*entry.action);
+      else journal->recordUndo();
     }
 
     void redo() {
       if (!hasRedo()) return;
-      actions.at(index)->redo();
+      stopMerging();
+      Entry& entry = actions.at(index);
+      entry.action->redo();
       index++;
+      if (!journal) return;
+      if (entry.serial < journal_base) journal->recordReapply(*entry.action);
+      else journal->recordRedo();
+    }
+
+    // Undoes or applies an action that is not in the history, for replaying
+    // the journal.
+    void revert(std::shared_ptr<Action> action) {
+      stopMerging();
+      action->undo();
+      if (journal) journal->recordRevert(*action);
+    }
+
+    void reapply(std::shared_ptr<Action> action) {
+      stopMerging();
+      action->apply();
+      if (journal) journal->recordReapply(*action);
     }
 
   private:
+    // The last action was open to merges until now, it gets to compact what
+    // it took in.
+    void stopMerging() {
+      if (can_merge) {
+        Action& last = *actions.back().action;
+        memory_used -= last.memoryUsage();
+        last.compact();
+        memory_used += last.memoryUsage();
+      }
+      can_merge = false;
+    }
+
+    void evict() {
+      while (memory_used > memory_limit && actions.size() > 1 && index > 0) {
+        memory_used -= actions.front().action->memoryUsage();
+        actions.pop_front();
+        index--;
+      }
+    }
+
+    struct Entry {
+      std::shared_ptr<Action> action;
+      // Increases with every action added to the history.
+      uint64_t serial;
+    };
+
     MapContext* map;
-    std::vector<std::shared_ptr<Action>> actions;
+    ActionJournal* journal = nullptr;
+    std::deque<Entry> actions;
     size_t index = 0;
+    uint64_t next_serial = 0;
+    uint64_t journal_base = 0;
+
+    size_t memory_used = 0;
+    size_t memory_limit = 64 * 1024 * 1024;
+    bool in_stroke = false;
+    bool can_merge = false;
   };
 }
\ No newline at end of file
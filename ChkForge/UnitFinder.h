@@ -1,100 +1,119 @@
 #pragma once
-// Modified from https://github.com/bwapi/bwapi/blob/bwapi5/bwapi/include/BWAPI/UnitFinder.h
-// and https://github.com/bwapi/bwapi/blob/bwapi5/bwapi/Frontend/BWAPILIB/Source/UnitFinder.cpp
 
-#include <set>
-#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 #include "../openbw/openbw/bwgame.h"
 
+/**
+
+Finds the units whose bounds overlap a rectangle, for selecting units in the
+editor.
+
+Units are binned in a uniform grid by the cell holding the top left of their
+bounds, so each is stored exactly once and a query only has to look at the
+cells its rectangle covers, widened up and to the left by the size of the
+largest unit added. Cells are flat arrays of bounds and units, and each
+unit's cell and slot are kept by unit index, so adding and removing a unit
+take constant time and queries allocate nothing once the result buffer has
+grown.
+
+Bounds are taken when a unit is added; a unit that moves has to be removed
+and added again.
+
+*/
 class UnitFinder
 {
 public:
-  UnitFinder() {}
+  // 128 pixel cells over the largest map, 256 tiles of 32 pixels.
+  static constexpr int cell_shift = 7;
+  static constexpr int grid_size = (256 * 32) >> cell_shift;
+
+  UnitFinder() : cells(grid_size * grid_size) {}
 
   void add(bwgame::unit_t* u) {
-    bwgame::rect dimensions = { u->sprite->position - u->unit_type->dimensions.from, u->sprite->position + u->unit_type->dimensions.to };
-    unitFinderX.insert(UnitCompare(dimensions.from.x, u));
-    unitFinderX.insert(UnitCompare(dimensions.to.x, u));
-    unitFinderY.insert(UnitCompare(dimensions.from.y, u));
-    unitFinderY.insert(UnitCompare(dimensions.to.y, u));
+    bwgame::rect dim = { u->sprite->position - u->unit_type->dimensions.from, u->sprite->position + u->unit_type->dimensions.to };
+    max_width = std::max(max_width, dim.to.x - dim.from.x);
+    max_height = std::max(max_height, dim.to.y - dim.from.y);
+
+    size_t cell_index = cell_at(dim.from.x, dim.from.y);
+    auto& cell = cells[cell_index];
+    if (u->index >= locations.size()) locations.resize(u->index + 1);
+    locations[u->index] = { uint32_t(cell_index), uint32_t(cell.size()) };
+    cell.push_back({ dim.from.x, dim.from.y, dim.to.x, dim.to.y, u });
+  }
+
+  void add(const std::vector<bwgame::unit_t*>& units) {
+    for (bwgame::unit_t* u : units) add(u);
   }
 
   void remove(bwgame::unit_t* u) {
-    bwgame::rect dim = { u->sprite->position - u->unit_type->dimensions.from, u->sprite->position + u->unit_type->dimensions.to };
+    if (u->index >= locations.size()) return;
+    Location& loc = locations[u->index];
+    if (loc.cell == Location::none) return;
+
+    // Fill the gap with the last entry of the cell.
+    auto& cell = cells[loc.cell];
+    Entry& last = cell.back();
+    locations[last.unit->index].slot = loc.slot;
+    cell[loc.slot] = last;
+    cell.pop_back();
+    loc.cell = Location::none;
+  }
 
-    removeFromSet(u, unitFinderX, dim.from.x);
-    removeFromSet(u, unitFinderX, dim.to.x);
-    removeFromSet(u, unitFinderY, dim.from.y);
-    removeFromSet(u, unitFinderY, dim.to.y);
+  void remove(const std::vector<bwgame::unit_t*>& units) {
+    for (bwgame::unit_t* u : units) remove(u);
   }
 
+  // Keeps the memory of the cells to be filled again.
   void clear() {
-    unitFinderX.clear();
-    unitFinderY.clear();
+    for (auto& cell : cells) cell.clear();
+    locations.clear();
+    max_width = 0;
+    max_height = 0;
   }
 
-  std::unordered_set<bwgame::unit_t*> find(int left, int top, int right, int bottom) const
+  // Replaces the contents of result with the units overlapping the
+  // rectangle, edges included, in no particular order.
+  void find(int left, int top, int right, int bottom, std::vector<bwgame::unit_t*>& result) const
   {
-    int searchRight = right, searchBottom = bottom;
-
-    // Extension is to take into account units whose dimensions completely eclipse the location being searched.
-    // The unit with the largest width/height can't eclipse the search 
-    if (right - left <= maxUnitWidth)
-      searchRight = left + maxUnitWidth;
-    if (bottom - top <= maxUnitHeight)
-      searchBottom = top + maxUnitHeight;
-
-    std::unordered_set<bwgame::unit_t*> foundUnitsX;
-    auto lowerXIter = unitFinderX.lower_bound(UnitCompare{ left, 0 });
-    // We add 1 to right and bottom search because upper_bound is not inclusive - we want it to be
-    auto upperXIter = unitFinderX.upper_bound(UnitCompare{ searchRight + 1, 0 });
-    for (auto it = lowerXIter; it != upperXIter; ++it)
-    {
-      if (it->unit->sprite == nullptr) continue;
-      if (it->unit->sprite->position.x - it->unit->unit_type->dimensions.from.x <= right)
-        foundUnitsX.insert(it->unit);
+    result.clear();
+    int from_x = cell_coord(left - max_width);
+    int from_y = cell_coord(top - max_height);
+    int to_x = cell_coord(right);
+    int to_y = cell_coord(bottom);
+    for (int y = from_y; y <= to_y; ++y) {
+      for (int x = from_x; x <= to_x; ++x) {
+        for (const Entry& e : cells[y * grid_size + x]) {
+          if (e.left > right || e.right < left || e.top > bottom || e.bottom < top) continue;
+          if (e.unit->sprite == nullptr) continue;
+          result.push_back(e.unit);
+        }
+      }
     }
-
-    std::unordered_set<bwgame::unit_t*> result;
-
-    auto lowerYIter = unitFinderY.lower_bound(UnitCompare{ top, 0 });
-    auto upperYIter = unitFinderY.upper_bound(UnitCompare{ searchBottom + 1, 0 });
-    for (auto it = lowerYIter; it != upperYIter; ++it)
-    {
-      // Ignore if the unit isn't within the X-bound
-      if (foundUnitsX.count(it->unit) == 0) continue;
-
-      if (it->unit->sprite == nullptr) continue;
-      if (it->unit->sprite->position.y - it->unit->unit_type->dimensions.from.y <= bottom)
-        result.insert(it->unit);
-    }
-    return result;
   }
 
 private:
-  struct UnitCompare
-  {
-    UnitCompare(int value, bwgame::unit_t* unit) : value(value), unit(unit) {}
-
-    int value;
+  struct Entry {
+    int left, top, right, bottom;
     bwgame::unit_t* unit;
+  };
 
-    bool operator <(UnitCompare const& other) const
-    {
-      return value < other.value;
-    }
+  struct Location {
+    static constexpr uint32_t none = ~uint32_t(0);
+    uint32_t cell = none;
+    uint32_t slot = 0;
   };
 
-  void removeFromSet(bwgame::unit_t* u, std::multiset<UnitCompare>& set, int value) {
-    auto find_unit_fn = [u](const UnitCompare& compare) { return compare.unit == u; };
+  static int cell_coord(int v) {
+    return std::clamp(v >> cell_shift, 0, grid_size - 1);
+  }
 
-    auto lowerXIter = set.lower_bound(UnitCompare{ value, 0 });
-    auto upperXIter = set.upper_bound(UnitCompare{ value + 1, 0 });
-    auto deleteIt = std::find_if(lowerXIter, upperXIter, find_unit_fn);
-    if (deleteIt != set.end()) set.erase(deleteIt);
+  static size_t cell_at(int x, int y) {
+    return size_t(cell_coord(y) * grid_size + cell_coord(x));
   }
 
-  int maxUnitWidth = 256, maxUnitHeight = 256;
-  std::multiset<UnitCompare> unitFinderX;
-  std::multiset<UnitCompare> unitFinderY;
+  std::vector<std::vector<Entry>> cells;
+  std::vector<Location> locations;
+  int max_width = 0, max_height = 0;
 };
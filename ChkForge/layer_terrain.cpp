@@ -1,9 +1,44 @@
 #include "layers.h"
+#include "mapview.h"
+#include "MapContext.h"
 
 using namespace ChkForge;
 
 bool TerrainLayer::mouseEvent(MapView* map, QMouseEvent* e)
 {
+  if (brush < 0) return false;
+
+  // Everything painted while the button is held down is undone at once
+  QPoint pos = map->pointToMap(e->pos());
+  QPoint tile{ pos.x() >> 5, pos.y() >> 5 };
+  QRect rect{ tile.x() - width / 2, tile.y() - height / 2, width, height };
+
+  switch (e->type())
+  {
+  case QEvent::MouseButtonPress:
+    if (e->button() == Qt::LeftButton) {
+      this->map->actions.beginStroke();
+      is_painting = true;
+      last_paint_tile = tile;
+      this->map->paint_terrain(rect, brush, clutter);
+      return true;
+    }
+    break;
+  case QEvent::MouseButtonRelease:
+    if (e->button() == Qt::LeftButton && is_painting) {
+      is_painting = false;
+      this->map->actions.endStroke();
+      return true;
+    }
+    break;
+  case QEvent::MouseMove:
+    if (is_painting) {
+      if (tile != last_paint_tile) this->map->paint_terrain(rect, brush, clutter);
+      last_paint_tile = tile;
+      return true;
+    }
+    break;
+  }
   return false;
 }
 void TerrainLayer::showContextMenu(QWidget* owner, const QPoint& position)
@@ -21,6 +56,14 @@ void TerrainLayer::reset()
 void TerrainLayer::logicUpdate()
 {
 }
+void TerrainLayer::setBrush(int tileGroup)
+{
+  brush = tileGroup;
+}
 void TerrainLayer::layerChanged(bool isEntering)
 {
+  if (is_painting) {
+    is_painting = false;
+    map->actions.endStroke();
+  }
 }
@@ -101,6 +101,9 @@ namespace ChkForge {
 
     virtual void layerChanged(bool isEntering) override;
 
+    // The tile group painted with, or -1 to paint nothing.
+    void setBrush(int tileGroup);
+
     enum class PlacementType {
       BrushIsom,
       BrushRect,
@@ -113,6 +116,8 @@ namespace ChkForge {
     int clutter = 5;
     PlacementType placement_type = PlacementType::BrushIsom;
     int brush = -1;
+    bool is_painting = false;
+    QPoint last_paint_tile;
 
     std::vector<int> tile_ids{};
   };
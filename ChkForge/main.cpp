@@ -8,14 +8,20 @@
 #include <QDir>
 #include <QFontDatabase>
 #include <QTemporaryFile>
+#include <QStandardPaths>
+#include <QProgressDialog>
 
 #include "../openbw/bwglobal.h"
 #include "../openbw/bwglobal_ui.h"
+#include "../openbw/openbw/asset_cache.h"
 #include "../openbw/openbw/ui/common.h"
 
 #include "icons.h"
 #include "Utils.h"
 
+#include <functional>
+#include <future>
+
 #include <CommanderLib/Logger.h>
 
 Logger logger;
@@ -26,8 +32,11 @@ namespace bwgame {
 
   namespace ui {
     void log_str(a_string str) {
+      static std::mutex log_mutex;
       static FILE* log_file = nullptr;
 
+      std::lock_guard<std::mutex> l(log_mutex);
+
       fwrite(str.data(), str.size(), 1, stdout);
       fflush(stdout);
       if (!log_file) log_file = fopen("log.txt", "wb");
@@ -44,39 +53,85 @@ namespace bwgame {
   }
 }
 
+// Data files are read through a cache next to the other application caches,
+// only the files it is missing are read from the CASC storage.
+std::shared_ptr<bwgame::data_loading::asset_cache> asset_cache;
+
+bwgame::a_string asset_cache_filename() {
+  QString cache_dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+  QDir().mkpath(cache_dir);
+  return toStdString(QDir(cache_dir).filePath("assets.cache"));
+}
+
 bool init_bwgame(const QString& starcraft_dir) {
   std::string install_dir = toStdString(starcraft_dir);
 
   try {
-    auto load_data_file = bwgame::data_loading::data_files_directory(install_dir);
-
-    bwgame::global_st.init(load_data_file);
+    auto load_data_file = bwgame::data_loading::cached_data_files_directory(install_dir, asset_cache_filename());
+    asset_cache = load_data_file.cache;
 
     bwgame::global_ui_st.global_volume = 0;
-    bwgame::global_ui_st.load_data_file = [&](bwgame::a_vector<uint8_t>& data, bwgame::a_string filename) {
-      load_data_file(data, std::move(filename));
+
+    const char* font_paths[] = {
+      "font/bl.ttf", // BlizzardGlobal
+      "font/BLIZZARD-REGULAR.TTF", // Blizzard
+      "font/EUROSTILE-REG.TTF", // Eurostile
+      "font/EUROSTILEEXT-REG.TTF", // EurostileExtReg
+      "font/UDTypos58B_P_H.ttf", // UDTypos58B-P
+      "font/UDTypos510B_P_H.ttf", // UDTypos510B-P
     };
-    bwgame::global_ui_st.init(load_data_file);
+    std::vector<std::vector<uint8_t>> font_data(std::size(font_paths));
+
+    // The loader is thread-safe and none of these depend on each other, so
+    // they all run concurrently. Everything is joined before the main window
+    // is created since it needs the game data and fonts right away. Tilesets
+    // are loaded when a map first uses them.
+    std::vector<std::pair<QString, std::function<void()>>> tasks;
+    tasks.emplace_back(QObject::tr("Loading game data"), [&] {
+      bwgame::global_st.init(load_data_file);
+    });
+    tasks.emplace_back(QObject::tr("Loading sounds and images"), [&] {
+      bwgame::global_ui_st.init(load_data_file);
+    });
+    for (size_t i = 0; i != font_data.size(); ++i) {
+      tasks.emplace_back(QObject::tr("Loading fonts"), [&, i] {
+        load_data_file(font_data[i], font_paths[i]);
+      });
+    }
 
-    auto load_font = [&](const char* font_path) {
-      std::vector<uint8_t> font_data;
-      load_data_file(font_data, font_path);
+    std::vector<std::future<void>> pending;
+    for (auto& task : tasks) {
+      pending.push_back(std::async(std::launch::async, task.second));
+    }
 
-      QByteArray fontData{ reinterpret_cast<char*>(font_data.data()), int(font_data.size()) };
-      if (QFontDatabase::addApplicationFontFromData(fontData) == -1) {
-        QMessageBox::critical(nullptr, QString(), QObject::tr("Failed to load font: %1").arg(font_path));
+    QProgressDialog progress(QObject::tr("Loading StarCraft data..."), QString(), 0, int(tasks.size()));
+    progress.setWindowTitle(QCoreApplication::applicationName());
+    progress.setWindowModality(Qt::ApplicationModal);
+    progress.setMinimumDuration(500);
+    progress.setValue(0);
+
+    size_t finished = 0;
+    while (finished != pending.size()) {
+      if (pending[finished].wait_for(std::chrono::milliseconds(15)) == std::future_status::ready) {
+        ++finished;
+        if (finished != tasks.size()) progress.setLabelText(tasks[finished].first);
+        progress.setValue(int(finished));
       }
-    };
+      QCoreApplication::processEvents();
+    }
+    // Rethrows the first failure, after everything has stopped using the loader.
+    for (auto& f : pending) f.get();
 
-    load_font("font/bl.ttf"); // BlizzardGlobal
-    load_font("font/BLIZZARD-REGULAR.TTF"); // Blizzard
-    load_font("font/EUROSTILE-REG.TTF"); // Eurostile
-    load_font("font/EUROSTILEEXT-REG.TTF"); // EurostileExtReg
-    load_font("font/UDTypos58B_P_H.ttf"); // UDTypos58B-P
-    load_font("font/UDTypos510B_P_H.ttf"); // UDTypos510B-P
+    for (size_t i = 0; i != font_data.size(); ++i) {
+      QByteArray fontData{ reinterpret_cast<char*>(font_data[i].data()), int(font_data[i].size()) };
+      if (QFontDatabase::addApplicationFontFromData(fontData) == -1) {
+        QMessageBox::critical(nullptr, QString(), QObject::tr("Failed to load font: %1").arg(font_paths[i]));
+      }
+    }
 
     //QMessageBox::about(nullptr, "", QFont::substitutes("EurostileExtReg").join(", "));
 
+    load_data_file.save();
     return true;
   }
   catch (const std::exception& ex) {
@@ -116,5 +171,9 @@ int main(int argc, char *argv[])
   MainWindow w;
   w.showMaximized();
 
-  return app.exec();
+  int result = app.exec();
+
+  // Add the files that were first loaded during the session, such as grps.
+  if (asset_cache) asset_cache->save();
+  return result;
 }
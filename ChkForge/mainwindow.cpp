@@ -18,6 +18,7 @@
 #include <MappingCoreLib/Sc.h>
 
 #include <DockAreaWidget.h>
+#include <QInputDialog>
 #include <QLabel>
 #include <QMessageBox>
 #include <QMdiArea>
@@ -34,6 +35,7 @@
 #include <QShortcut>
 
 #include <filesystem>
+#include <fstream>
 
 #include "MapContext.h"
 #include "language.h"
@@ -78,6 +80,9 @@ MainWindow::MainWindow(QWidget *parent)
 
   updateMenusEnabled(false);
   applyTranslations();
+
+  connect(&map_load_timer, &QTimer::timeout, this, &MainWindow::updateMapLoads);
+  QTimer::singleShot(0, this, &MainWindow::recoverUnsavedMaps);
 }
 
 void MainWindow::applyTranslations() {
@@ -196,6 +201,7 @@ void MainWindow::createMapView(std::shared_ptr<ChkForge::MapContext> map)
   mapView->setWindowIcon(map_icon);
 
   connect(mapView, &MapView::aboutToClose, minimap, &Minimap::onCloseMapView);
+  connect(mapView, &MapView::aboutToClose, outputWindow, &OutputWindow::onCloseMapView);
   connect(mapView, &MapView::setItemTreeSelectionSignal, itemTree, &ItemTree::set_item);
 }
 
@@ -213,6 +219,10 @@ void MainWindow::createToolWindows()
   ui->menu_Tool_Windows->addAction(terrainBrush->toggleViewAction());
   m_DockManager->addDockWidget(ads::BottomDockWidgetArea, terrainBrush, leftPane);
 
+  outputWindow = new OutputWindow(this);
+  ui->menu_Tool_Windows->addAction(outputWindow->toggleViewAction());
+  m_DockManager->addDockWidget(ads::BottomDockWidgetArea, outputWindow);
+
   connect(itemTree, &ItemTree::itemTreeChanged, this, &MainWindow::onItemTreeChanged);
 }
 
@@ -338,7 +348,10 @@ void MainWindow::toggleToolWindows(bool isOpen)
   }
 }
 
-MainWindow::~MainWindow() {}
+MainWindow::~MainWindow() {
+  for (auto& load : map_loads) load.progress->cancelled = true;
+  for (auto& load : map_loads) load.task.wait();
+}
 
 void MainWindow::on_action_file_new_triggered()
 {
@@ -349,17 +362,120 @@ void MainWindow::on_action_file_new_triggered()
   createNewMap(newMap.tile_width, newMap.tile_height, Sc::Terrain::Tileset(newMap.tileset->getTilesetId()), newMap.brush, newMap.clutter);
 }
 
-bool MainWindow::open_map(const std::filesystem::path& map_filename)
+bool MainWindow::open_map(const std::filesystem::path& map_filename, const std::filesystem::path& journal)
 {
   if (map_filename.empty()) return false;
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(map_filename, ec) || !std::ifstream(map_filename, std::ios::binary)) {
+    QMessageBox::critical(this, QString(), tr("Failed to open %1:\n%2").arg(QString::fromStdString(map_filename.string()), tr("The file could not be read.")));
+    return false;
+  }
 
-  auto map = ChkForge::MapContext::create();
-  if (map->load_map(map_filename)) {
-    createMapView(map);
-    addRecentFile(map_filename);
-    return true;
+  // The map is read and converted on a worker thread; it has no views until
+  // updateMapLoads sees the load finish, so nothing else touches it until then.
+  auto& load = map_loads.emplace_back();
+  load.filename = map_filename;
+  load.journal = journal;
+  load.map = ChkForge::MapContext::create();
+  load.progress = std::make_unique<ChkForge::MapContext::LoadProgress>();
+  load.task = std::async(std::launch::async, [map = load.map.get(), progress = load.progress.get(), map_filename] {
+    return map->load_map(map_filename, progress);
+  });
+
+  if (map_load_progress == nullptr) {
+    map_load_progress = new QProgressDialog(this);
+    map_load_progress->setWindowTitle(tr("Opening"));
+    map_load_progress->setAutoReset(false);
+    map_load_progress->setAutoClose(false);
+    map_load_progress->setMinimumDuration(500);
+    connect(map_load_progress, &QProgressDialog::canceled, this, [this] {
+      for (auto& load : map_loads) load.progress->cancelled = true;
+    });
+  }
+  if (!map_load_timer.isActive()) map_load_timer.start(50);
+  updateMapLoads();
+  return true;
+}
+
+void MainWindow::updateMapLoads()
+{
+  // Take the finished loads out of the list first, error messages run a
+  // nested event loop in which this gets called again.
+  std::list<MapLoad> finished;
+  for (auto it = map_loads.begin(); it != map_loads.end();) {
+    auto next = std::next(it);
+    if (it->task.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      finished.splice(finished.end(), map_loads, it);
+      ++map_loads_finished;
+    }
+    it = next;
+  }
+
+  if (map_loads.empty()) {
+    map_load_timer.stop();
+    map_loads_finished = 0;
+    map_load_progress->reset();
+    map_load_progress->hide();
+  }
+  else {
+    constexpr int stages = ChkForge::MapContext::LoadProgress::Done;
+    int value = map_loads_finished * stages;
+    for (auto& load : map_loads) value += load.progress->stage;
+
+    if (map_loads.size() == 1) {
+      map_load_progress->setLabelText(tr("Opening %1...").arg(QString::fromStdString(map_loads.front().filename.filename().string())));
+    }
+    else {
+      map_load_progress->setLabelText(tr("Opening %n maps...", "", int(map_loads.size())));
+    }
+    map_load_progress->setMaximum(int(map_loads_finished + map_loads.size()) * stages);
+    map_load_progress->setValue(value);
+  }
+
+  for (auto& load : finished) {
+    try {
+      if (load.task.get()) {
+        if (!load.journal.empty()) load.map->recover(load.journal);
+        createMapView(load.map);
+        addRecentFile(load.filename);
+      }
+    }
+    catch (const std::exception& e) {
+      QMessageBox::critical(this, QString(), tr("Failed to open %1:\n%2").arg(QString::fromStdString(load.filename.string()), QString::fromStdString(e.what())));
+    }
+    catch (...) {
+      QMessageBox::critical(this, QString(), tr("Unknown error opening %1.").arg(QString::fromStdString(load.filename.string())));
+    }
+  }
+}
+
+void MainWindow::recoverUnsavedMaps()
+{
+  for (auto& journal : ChkForge::ActionJournal::findOrphaned()) {
+    auto base = ChkForge::ActionJournal::readBase(journal);
+    if (!base) {
+      ChkForge::ActionJournal::remove(journal);
+      continue;
+    }
+
+    QString map_name = base->map_file.empty() ? tr("a new map") : QString::fromStdString(base->map_file.string());
+    auto result = QMessageBox::question(this, tr("Recover unsaved changes"),
+      tr("ChkForge did not close properly. Do you want to recover the unsaved changes to %1?").arg(map_name));
+    if (result != QMessageBox::Yes) {
+      ChkForge::ActionJournal::remove(journal);
+      continue;
+    }
+
+    if (base->map_file.empty()) {
+      auto map = ChkForge::MapContext::create();
+      map->new_map(base->tile_width, base->tile_height, base->tileset, base->brush, base->clutter, base->tiles);
+      map->recover(journal);
+      createMapView(map);
+    }
+    else {
+      open_map(base->map_file, journal);
+    }
   }
-  return false;
 }
 
 void MainWindow::on_action_file_open_triggered()
@@ -453,6 +569,20 @@ void MainWindow::on_action_edit_paste_triggered()
 
 void MainWindow::on_action_edit_delete_triggered()
 {
+  auto map = currentMap();
+  if (map == nullptr) return;
+
+  auto& openbw_ui = map->openbw_ui;
+  if (openbw_ui.current_selection.empty()) return;
+
+  std::vector<bwgame::unit_t*> units;
+  units.reserve(openbw_ui.current_selection.size());
+  for (auto uid : openbw_ui.current_selection) {
+    bwgame::unit_t* u = openbw_ui.get_unit(uid);
+    if (u != nullptr) units.push_back(u);
+  }
+  openbw_ui.current_selection_clear();
+  map->removeUnits(units);
 }
 
 void MainWindow::on_action_edit_selectAll_triggered()
@@ -533,6 +663,26 @@ void MainWindow::on_action_tools_mapRevealers_triggered()
 
 void MainWindow::on_action_tools_stackUnits_triggered()
 {
+  auto map = currentMap();
+  if (map == nullptr) return;
+
+  auto& openbw_ui = map->openbw_ui;
+  if (openbw_ui.current_selection.empty()) return;
+
+  bool ok = false;
+  int copies = QInputDialog::getInt(this, tr("Stack Units"), tr("Copies of each selected unit:"), 1, 1, 1700, 1, &ok);
+  if (!ok) return;
+
+  std::vector<ChkForge::PlaceUnitsAction::Unit> units;
+  units.reserve(openbw_ui.current_selection.size() * copies);
+  for (auto uid : openbw_ui.current_selection) {
+    bwgame::unit_t* u = openbw_ui.get_unit(uid);
+    if (u == nullptr || u->sprite == nullptr) continue;
+    for (int i = 0; i != copies; ++i) {
+      units.push_back({ uint16_t(u->sprite->position.x), uint16_t(u->sprite->position.y), Sc::Unit::Type(u->unit_type->id), uint8_t(u->owner) });
+    }
+  }
+  map->placeUnits(std::move(units));
 }
 
 void MainWindow::on_action_tools_preferences_triggered()
@@ -778,6 +928,7 @@ void MainWindow::onMdiSubWindowActivated(QMdiSubWindow* window)
 {
   if (window == nullptr) {
     minimap->setActiveMapView(nullptr);
+    outputWindow->setActiveMapView(nullptr);
     statusBar_ui->lbl_coordinates->setText("");
     updateMenusEnabled(false);
     return;
@@ -785,6 +936,7 @@ void MainWindow::onMdiSubWindowActivated(QMdiSubWindow* window)
 
   MapView* map = qobject_cast<MapView*>(window);
   minimap->setActiveMapView(map);
+  outputWindow->setActiveMapView(map);
 
   disconnect(this, SLOT(mapMouseMoved(const QPoint&)));
   disconnect(this, SLOT(onUndoRedoUpdated));
@@ -867,6 +1019,7 @@ void MainWindow::onItemTreeChanged(ItemTree::Category category, int id)
       break;
     case ItemTree::CAT_TERRAIN:
       selectLayerIndex(ChkForge::Layer_t::LAYER_TERRAIN);
+      map->set_layer_terrain_brush(id);
       break;
     case ItemTree::CAT_DOODAD:
       selectLayerIndex(ChkForge::Layer_t::LAYER_DOODAD);
@@ -973,6 +1126,7 @@ void MainWindow::dropEvent(QDropEvent* event)
 
   for (auto& url : event->mimeData()->urls()) {
     if (isValidFormat(url.toLocalFile())) {
+      // Each map loads on its own worker, so dropping several loads them in parallel.
       std::filesystem::path path = toStdString(url.toLocalFile());
       if (open_map(path)) {
         event->acceptProposedAction();
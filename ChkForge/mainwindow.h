@@ -4,7 +4,11 @@
 #include <QMdiArea>
 #include <QIcon>
 #include <QSettings>
+#include <QProgressDialog>
+#include <QTimer>
 #include <DockManager.h>
+#include <future>
+#include <list>
 #include <memory>
 
 #include "ui_mainwindow.h"
@@ -14,6 +18,7 @@
 #include "MapContext.h"
 
 #include "itemtree.h"
+#include "outputwindow.h"
 #include "PluginManager.h"
 
 class MapView;
@@ -42,6 +47,7 @@ private:
   Minimap* minimap = new Minimap();
   QMdiArea* mdi = new QMdiArea();
   ItemTree* itemTree;
+  OutputWindow* outputWindow;
 
   std::unique_ptr<ads::CDockManager> m_DockManager;
   ads::CDockWidget* mdi_dock = new ads::CDockWidget("");
@@ -61,6 +67,20 @@ private:
   QSettings settings;
 
   PluginManager scmd_pluginManager;
+
+  // Maps being loaded on worker threads, see open_map.
+  struct MapLoad {
+    std::filesystem::path filename;
+    // Journal to recover on top of the map once it has loaded, if any.
+    std::filesystem::path journal;
+    std::shared_ptr<ChkForge::MapContext> map;
+    std::unique_ptr<ChkForge::MapContext::LoadProgress> progress;
+    std::future<bool> task;
+  };
+  std::list<MapLoad> map_loads;
+  int map_loads_finished = 0;
+  QProgressDialog* map_load_progress = nullptr;
+  QTimer map_load_timer;
 private:
   template <typename Func>
   void connectTrigger(QAction* action, const Func& method) {
@@ -89,7 +109,11 @@ private:
 
   virtual void keyPressEvent(QKeyEvent* event) override;
 
-  bool open_map(const std::filesystem::path& map_filename);
+  // Starts loading the map in the background. Returns false if the file can't
+  // be read; errors found while loading are reported when the load finishes.
+  bool open_map(const std::filesystem::path& map_filename, const std::filesystem::path& journal = {});
+  void updateMapLoads();
+  void recoverUnsavedMaps();
   void on_recent_file_triggered();
   void addRecentFile(std::filesystem::path filename);
   void resetRecentFileMenu();
@@ -2,6 +2,7 @@
 #include "ui_mapview.h"
 
 #include <QCloseEvent>
+#include <QFontDatabase>
 #include <QMessageBox>
 #include <QSize>
 #include <QWindow>
@@ -51,6 +52,9 @@ MapView::~MapView()
 
 void MapView::closeEvent(QCloseEvent* closeEvent)
 {
+  // A save still being written decides whether there is anything left to save.
+  if (map->has_one_view()) map->finish_save();
+
   if (map->has_one_view() && map->is_unsaved()) {
     auto widget = qobject_cast<ads::CDockWidget*>(sender());
 
@@ -62,7 +66,11 @@ void MapView::closeEvent(QCloseEvent* closeEvent)
 
     switch (result) {
     case QMessageBox::Save:
-      map->save();
+      // Wait for the write, the map is gone once the view closes.
+      if (!map->save() || !map->finish_save()) {
+        closeEvent->ignore();
+        return;
+      }
       break;
     case QMessageBox::Discard:
       break;
@@ -328,9 +336,48 @@ void MapView::paint_surface(QWidget* obj, QPaintEvent* paintEvent)
 
   map->get_layer()->paintOverlay(this, obj, painter);
 
+  if (map->is_perf_hud_visible()) paint_perf_hud(painter);
+
   painter.end();
 }
 
+void MapView::paint_perf_hud(QPainter& painter)
+{
+  using perf_counters_t = bwgame::perf_counters_t;
+  auto& perf = map->get_perf_counters();
+  auto& st = map->openbw_ui.st;
+
+  QStringList lines;
+  for (size_t i = 0; i != perf_counters_t::timer_count; ++i) {
+    if (i == perf_counters_t::timer_load_map) continue;
+    auto& t = perf.timers[i];
+    if (t.calls == 0) continue;
+    lines << QString("%1 %2 ms").arg(perf_counters_t::timer_name(i), -17).arg(t.average.count() / 1000000.0, 6, 'f', 2);
+  }
+
+  auto unit_count = std::distance(st.visible_units.begin(), st.visible_units.end());
+  lines << QString("%1 %2").arg("sprites drawn", -17).arg(perf.counters[perf_counters_t::counter_sprites_drawn].last);
+  lines << QString("%1 %2").arg("units", -17).arg(qlonglong(unit_count));
+  lines << QString("%1 %2").arg("bullets", -17).arg(st.active_bullets_size);
+  lines << QString("%1 %2").arg("thingies", -17).arg(st.active_thingies_size);
+
+  painter.save();
+  painter.setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  QFontMetrics metrics = painter.fontMetrics();
+  int width = 0;
+  for (auto& line : lines) width = std::max(width, metrics.horizontalAdvance(line));
+  QRect area{ 4, 4, width + 8, metrics.height() * int(lines.size()) + 8 };
+
+  painter.fillRect(area, QColor(0, 0, 0, 160));
+  painter.setPen(QColorConstants::White);
+  int y = area.top() + 4 + metrics.ascent();
+  for (auto& line : lines) {
+    painter.drawText(area.left() + 4, y, line);
+    y += metrics.height();
+  }
+  painter.restore();
+}
+
 QPoint MapView::getScreenPos()
 {
   return screen_position.topLeft();
@@ -392,7 +439,7 @@ void MapView::select_units(bool double_clicked, bool shift, bool ctrl, const QRe
   
   if (!shift) map->openbw_ui.current_selection_clear();
 
-  auto units_to_select = map->find_units(map->toBw(translated));
+  const auto& units_to_select = map->find_units(map->toBw(translated));
   for (bwgame::unit_t* u : units_to_select) {
     map->openbw_ui.current_selection_add(u);
   }
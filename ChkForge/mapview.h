@@ -15,6 +15,8 @@ namespace ChkForge {
   class MapContext;
 }
 
+class QPainter;
+
 namespace Ui {
   class MapView;
 }
@@ -83,6 +85,7 @@ private:
   bool surfaceEventFilter(QObject* obj, QEvent* e);
   bool mouseEventFilter(QObject* obj, QEvent* e);
   void paint_surface(QWidget* obj, QPaintEvent* paintEvent);
+  void paint_perf_hud(QPainter& painter);
 
   void resizeSurface(QSize newSize);
 
@@ -1,11 +1,284 @@
 #include "outputwindow.h"
 #include "ui_outputwindow.h"
 
-OutputWindow::OutputWindow(QWidget *parent) :
-  QFrame(parent),
-  ui(std::make_unique<Ui::OutputWindow>())
+#include <QFile>
+#include <QFileDialog>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMessageBox>
+#include <QTextStream>
+
+#include <cmath>
+#include <map>
+
+#include "mapview.h"
+#include "MapContext.h"
+#include "strings.h"
+
+namespace {
+  double toMilliseconds(std::chrono::nanoseconds time) {
+    return std::round(time.count() / 1000.0) / 1000.0;
+  }
+}
+
+OutputWindow::OutputWindow(QWidget *parent)
+  : DockWidgetWrapper(tr("Output"), parent)
+  , ui(std::make_unique<Ui::OutputWindow>())
+  , profileModel(0, COL_COUNT, this)
+  , perfModel(0, PERF_COL_COUNT, this)
 {
-  ui->setupUi(this);
+  ui->setupUi(&frame);
+  setupDockWidget();
+
+  profileModel.setHorizontalHeaderLabels({
+    tr("Trigger"), tr("Player"), tr("Evaluations"), tr("Fires"), tr("Conditions (ms)"), tr("Actions (ms)"), tr("Total (ms)")
+  });
+  profileProxyModel.setSourceModel(&profileModel);
+  profileProxyModel.setSortRole(Qt::DisplayRole);
+
+  ui->tbl_triggerProfile->setModel(&profileProxyModel);
+  ui->tbl_triggerProfile->sortByColumn(COL_TOTAL_MS, Qt::DescendingOrder);
+
+  connect(ui->chk_profileTriggers, &QCheckBox::toggled, this, &OutputWindow::onProfileTriggersToggled);
+  connect(ui->btn_resetProfile, &QPushButton::clicked, this, &OutputWindow::onResetProfile);
+  connect(ui->btn_exportProfile, &QPushButton::clicked, this, &OutputWindow::onExportProfile);
+  connect(&profileTimer, &QTimer::timeout, this, &OutputWindow::updateTriggerProfile);
+
+  perfModel.setHorizontalHeaderLabels({
+    tr("Timer"), tr("Calls"), tr("Last (ms)"), tr("Average (ms)"), tr("Max (ms)"), tr("Total (ms)")
+  });
+  ui->tbl_perfCounters->setModel(&perfModel);
+
+  connect(ui->chk_perfHud, &QCheckBox::toggled, this, &OutputWindow::onPerfHudToggled);
+  connect(ui->btn_resetPerf, &QPushButton::clicked, this, &OutputWindow::onResetPerf);
+  connect(&perfTimer, &QTimer::timeout, this, &OutputWindow::updatePerfCounters);
+
+  setActiveMapView(nullptr);
 }
 
 OutputWindow::~OutputWindow() {}
+
+void OutputWindow::setActiveMapView(MapView* view)
+{
+  activeMapView = view;
+
+  // The profile is cleared whenever the map is reloaded, its rows go with it
+  disconnect(profileClearedConnection);
+  if (view) {
+    profileClearedConnection = connect(view->getMap().get(), &ChkForge::MapContext::triggerProfileCleared, this, [this] {
+      profileModel.setRowCount(0);
+    });
+  }
+
+  bool profiling = view && view->getMap()->is_trigger_profiling();
+  ui->chk_profileTriggers->setEnabled(view != nullptr);
+  ui->chk_profileTriggers->setChecked(profiling);
+  ui->btn_resetProfile->setEnabled(view != nullptr);
+  ui->btn_exportProfile->setEnabled(view != nullptr);
+
+  profileModel.setRowCount(0);
+  updateTriggerProfile();
+
+  ui->chk_perfHud->setEnabled(view != nullptr);
+  ui->chk_perfHud->setChecked(view && view->getMap()->is_perf_hud_visible());
+  ui->btn_resetPerf->setEnabled(view != nullptr);
+
+  perfModel.setRowCount(0);
+  updatePerfCounters();
+  if (view) perfTimer.start(1000);
+  else perfTimer.stop();
+}
+
+void OutputWindow::onCloseMapView(MapView* map)
+{
+  if (activeMapView == map) setActiveMapView(nullptr);
+}
+
+void OutputWindow::onProfileTriggersToggled(bool checked)
+{
+  if (activeMapView) activeMapView->getMap()->set_trigger_profiling(checked);
+
+  if (checked) profileTimer.start(500);
+  else profileTimer.stop();
+}
+
+void OutputWindow::onResetProfile()
+{
+  if (activeMapView) activeMapView->getMap()->reset_trigger_profile();
+}
+
+void OutputWindow::updateTriggerProfile()
+{
+  if (!activeMapView) return;
+
+  auto& profile = activeMapView->getMap()->get_trigger_profile();
+
+  // Rows are keyed by trigger and player so that sorting and selection survive a refresh
+  std::map<std::pair<int, int>, int> existing_rows;
+  for (int row = 0; row < profileModel.rowCount(); ++row) {
+    int trigger = profileModel.item(row, COL_TRIGGER)->data(Qt::DisplayRole).toInt();
+    int player = profileModel.item(row, COL_PLAYER)->data(Qt::UserRole).toInt();
+    existing_rows.emplace(std::make_pair(trigger, player), row);
+  }
+
+  for (size_t trigger = 0; trigger < profile.triggers.size(); ++trigger) {
+    for (int player = 0; player < 8; ++player) {
+      auto& e = profile.triggers[trigger][player];
+      if (e.evaluations == 0) continue;
+
+      QList<QVariant> values = {
+        int(trigger) + 1,
+        ChkForge::getGenericPlayerName(player),
+        qulonglong(e.evaluations),
+        qulonglong(e.fires),
+        toMilliseconds(e.condition_time),
+        toMilliseconds(e.action_time),
+        toMilliseconds(e.condition_time + e.action_time)
+      };
+
+      auto it = existing_rows.find({ int(trigger) + 1, player });
+      if (it == existing_rows.end()) {
+        QList<QStandardItem*> items;
+        for (auto& value : values) {
+          auto item = new QStandardItem();
+          item->setData(value, Qt::DisplayRole);
+          items.append(item);
+        }
+        items[COL_PLAYER]->setData(player, Qt::UserRole);
+        profileModel.appendRow(items);
+      }
+      else {
+        for (int col = COL_EVALUATIONS; col < COL_COUNT; ++col) {
+          profileModel.item(it->second, col)->setData(values[col], Qt::DisplayRole);
+        }
+      }
+    }
+  }
+}
+
+void OutputWindow::onExportProfile()
+{
+  if (!activeMapView) return;
+  updateTriggerProfile();
+
+  static const QString csvFilter = tr("CSV Files (*.csv)");
+  static const QString jsonFilter = tr("JSON Files (*.json)");
+
+  QString selectedFilter;
+  QString filename = QFileDialog::getSaveFileName(this, tr("Export Trigger Profile"), QString(), csvFilter + ";;" + jsonFilter, &selectedFilter);
+  if (filename.isEmpty()) return;
+
+  bool as_json = filename.endsWith(".json", Qt::CaseInsensitive) || (selectedFilter == jsonFilter && !filename.endsWith(".csv", Qt::CaseInsensitive));
+  bool result = as_json ? exportJson(filename) : exportCsv(filename);
+  if (!result) {
+    QMessageBox::critical(this, QString(), tr("Failed to write \"%1\".").arg(filename));
+  }
+}
+
+bool OutputWindow::exportCsv(const QString& filename)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)) return false;
+
+  QTextStream out(&file);
+  out << "trigger,player,evaluations,fires,condition_ms,action_ms,total_ms\n";
+
+  auto& profile = activeMapView->getMap()->get_trigger_profile();
+  for (size_t trigger = 0; trigger < profile.triggers.size(); ++trigger) {
+    for (int player = 0; player < 8; ++player) {
+      auto& e = profile.triggers[trigger][player];
+      if (e.evaluations == 0) continue;
+      out << trigger + 1 << ',' << player + 1 << ',' << e.evaluations << ',' << e.fires << ','
+        << toMilliseconds(e.condition_time) << ',' << toMilliseconds(e.action_time) << ','
+        << toMilliseconds(e.condition_time + e.action_time) << '\n';
+    }
+  }
+  return out.status() == QTextStream::Ok;
+}
+
+bool OutputWindow::exportJson(const QString& filename)
+{
+  QJsonArray rows;
+
+  auto& profile = activeMapView->getMap()->get_trigger_profile();
+  for (size_t trigger = 0; trigger < profile.triggers.size(); ++trigger) {
+    for (int player = 0; player < 8; ++player) {
+      auto& e = profile.triggers[trigger][player];
+      if (e.evaluations == 0) continue;
+      rows.append(QJsonObject{
+        {"trigger", int(trigger) + 1},
+        {"player", player + 1},
+        {"evaluations", qint64(e.evaluations)},
+        {"fires", qint64(e.fires)},
+        {"condition_ms", toMilliseconds(e.condition_time)},
+        {"action_ms", toMilliseconds(e.action_time)},
+        {"total_ms", toMilliseconds(e.condition_time + e.action_time)}
+      });
+    }
+  }
+
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+  return file.write(QJsonDocument(rows).toJson()) != -1;
+}
+
+void OutputWindow::onPerfHudToggled(bool checked)
+{
+  if (activeMapView) activeMapView->getMap()->set_perf_hud_visible(checked);
+}
+
+void OutputWindow::onResetPerf()
+{
+  if (activeMapView) activeMapView->getMap()->get_perf_counters().clear();
+  updatePerfCounters();
+}
+
+void OutputWindow::updatePerfCounters()
+{
+  if (!activeMapView) return;
+
+  using perf_counters_t = bwgame::perf_counters_t;
+  auto& perf = activeMapView->getMap()->get_perf_counters();
+
+  // One row per timer, followed by one per counter, always in the same order
+  int rows = perf_counters_t::timer_count + perf_counters_t::counter_count;
+  if (perfModel.rowCount() != rows) {
+    perfModel.setRowCount(0);
+    for (int row = 0; row < rows; ++row) {
+      QList<QStandardItem*> items;
+      for (int col = 0; col < PERF_COL_COUNT; ++col) items.append(new QStandardItem());
+      perfModel.appendRow(items);
+    }
+  }
+
+  auto set_row = [&](int row, const QList<QVariant>& values) {
+    for (int col = 0; col < PERF_COL_COUNT; ++col) {
+      perfModel.item(row, col)->setData(col < values.size() ? values[col] : QVariant(), Qt::DisplayRole);
+    }
+  };
+
+  for (size_t i = 0; i != perf_counters_t::timer_count; ++i) {
+    auto& t = perf.timers[i];
+    set_row(int(i), {
+      perf_counters_t::timer_name(i),
+      qulonglong(t.calls),
+      toMilliseconds(t.last),
+      toMilliseconds(t.average),
+      toMilliseconds(t.max),
+      toMilliseconds(t.total)
+    });
+  }
+  // Counters are not times; they only fill the Last and Total columns
+  for (size_t i = 0; i != perf_counters_t::counter_count; ++i) {
+    auto& c = perf.counters[i];
+    set_row(int(perf_counters_t::timer_count + i), {
+      perf_counters_t::counter_name(i),
+      QVariant(),
+      qulonglong(c.last),
+      QVariant(),
+      QVariant(),
+      qulonglong(c.total)
+    });
+  }
+}
@@ -1,19 +1,71 @@
 #pragma once
-#include <QFrame>
+#include "DockWidgetWrapper.h"
+
+#include <QStandardItemModel>
+#include <QSortFilterProxyModel>
+#include <QTimer>
 #include <memory>
 
+class MapView;
+
 namespace Ui {
   class OutputWindow;
 }
 
-class OutputWindow : public QFrame
+class OutputWindow : public DockWidgetWrapper
 {
   Q_OBJECT
 
 public:
   explicit OutputWindow(QWidget *parent = nullptr);
-  ~OutputWindow();
+  virtual ~OutputWindow() override;
+
+  void setActiveMapView(MapView* view);
+  void onCloseMapView(MapView* map);
 
 private:
   std::unique_ptr<Ui::OutputWindow> ui;
+
+  QStandardItemModel profileModel;
+  QSortFilterProxyModel profileProxyModel;
+
+  QTimer profileTimer;
+  MapView* activeMapView = nullptr;
+  QMetaObject::Connection profileClearedConnection;
+
+  QStandardItemModel perfModel;
+  QTimer perfTimer;
+
+  enum ProfileColumn {
+    COL_TRIGGER,
+    COL_PLAYER,
+    COL_EVALUATIONS,
+    COL_FIRES,
+    COL_CONDITION_MS,
+    COL_ACTION_MS,
+    COL_TOTAL_MS,
+    COL_COUNT
+  };
+
+  void updateTriggerProfile();
+  void onProfileTriggersToggled(bool checked);
+  void onResetProfile();
+  void onExportProfile();
+
+  bool exportCsv(const QString& filename);
+  bool exportJson(const QString& filename);
+
+  enum PerfColumn {
+    PERF_COL_NAME,
+    PERF_COL_CALLS,
+    PERF_COL_LAST_MS,
+    PERF_COL_AVERAGE_MS,
+    PERF_COL_MAX_MS,
+    PERF_COL_TOTAL_MS,
+    PERF_COL_COUNT
+  };
+
+  void updatePerfCounters();
+  void onPerfHudToggled(bool checked);
+  void onResetPerf();
 };
@@ -33,7 +33,7 @@ std::map<int, std::map<int, QIcon>> Tileset::TileGroup::icon_cache;
 const QIcon& Tileset::TileGroup::getIcon() const
 {
   if (!icon_cache[tilesetId].contains(groupId)) {
-    const bwgame::tileset_image_data& tileset_img = bwgame::global_ui_st.all_tileset_img[tilesetId];
+    const bwgame::tileset_image_data& tileset_img = bwgame::global_ui_st.get_tileset_img(tilesetId);
 
     QImage tile_img{ 32, 32, QImage::Format::Format_Indexed8 };
     tile_img.setColorCount(256);
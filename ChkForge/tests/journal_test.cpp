@@ -0,0 +1,196 @@
+#include "tests.h"
+#include "../ActionJournal.h"
+#include "../UndoManager.h"
+
+#include <functional>
+#include <set>
+#include <QStandardPaths>
+
+using namespace ChkForge;
+
+namespace {
+  // Stands in for the map, replays are checked against the values the
+  // edits left behind. Values can repeat, so a record replayed twice shows.
+  using Values = std::multiset<int>;
+
+  class AddValueAction : public Action {
+  public:
+    AddValueAction(Values& values, int value) : Action(nullptr), values(values), value(value) {}
+
+    virtual void apply() override { values.insert(value); }
+    virtual void undo() override {
+      auto it = values.find(value);
+      if (it != values.end()) values.erase(it);
+    }
+    virtual size_t memoryUsage() const override { return sizeof(*this); }
+
+    // The journal only passes the type through, any will do.
+    virtual ActionType type() const override { return ActionType::PlaceUnit; }
+    virtual void write(JournalWriter& w) const override { w.u32(uint32_t(value)); }
+
+  private:
+    Values& values;
+    int value;
+  };
+
+  std::filesystem::path journal_dir() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation).toStdWString() + L"/journal";
+  }
+
+  // An editing session as MapContext runs it, with a save that rebases the
+  // journal the way saveAs and finish_save do.
+  struct Session {
+    Values values;
+    Values saved;
+    ActionJournal journal;
+    UndoManager undo{ nullptr };
+
+    Session() {
+      undo.setJournal(&journal);
+      journal.setBase({ "test.scx" });
+    }
+
+    void add(int value) {
+      undo.applyAction(std::make_shared<AddValueAction>(values, value));
+    }
+
+    void save() {
+      finishSave(beginSave());
+    }
+
+    size_t beginSave() {
+      saved = values;
+      size_t position = journal.position();
+      undo.setJournalBase(undo.mark());
+      return position;
+    }
+
+    void finishSave(size_t position) {
+      journal.setBase({ "test.scx" }, position);
+    }
+
+    // Replays a copy of the journal onto the saved values, as recovery
+    // would after a crash at this point.
+    Values recover() {
+      journal.sync();
+      std::filesystem::path copy = journal_dir() / "copy.journal.test";
+      for (auto& entry : std::filesystem::directory_iterator(journal_dir())) {
+        if (entry.path().extension() == ".journal") std::filesystem::copy_file(entry.path(), copy, std::filesystem::copy_options::overwrite_existing);
+      }
+      Values replayed = saved;
+      UndoManager replay_undo{ nullptr };
+      ActionJournal::replay(copy, replay_undo, [&](ActionType type, JournalReader& r) {
+        return std::make_shared<AddValueAction>(replayed, int(r.u32()));
+      });
+      std::filesystem::remove(copy);
+      return replayed;
+    }
+  };
+
+  void checkReplay(const std::function<void(Session&)>& edits) {
+    Session s;
+    edits(s);
+    CHECK(s.recover() == s.values);
+  }
+}
+
+void ChkForge::Tests::journalTests()
+{
+  std::error_code ec;
+  std::filesystem::remove_all(journal_dir(), ec);
+
+  checkReplay([](Session& s) {
+    s.add(1);
+    s.add(2);
+    s.undo.undo();
+    s.undo.redo();
+    s.undo.undo();
+  });
+
+  // Undoing past a save reverts an action the journal has no record of.
+  checkReplay([](Session& s) {
+    s.add(1);
+    s.save();
+    s.undo.undo();
+    CHECK(s.values.empty());
+  });
+
+  checkReplay([](Session& s) {
+    s.add(1);
+    s.save();
+    s.add(2);
+    s.undo.undo();
+    s.undo.undo();
+    CHECK(s.values.empty());
+  });
+
+  checkReplay([](Session& s) {
+    s.add(1);
+    s.add(2);
+    s.save();
+    s.undo.undo();
+    s.undo.undo();
+    s.undo.redo();
+    s.add(3);
+    s.undo.undo();
+    s.undo.redo();
+  });
+
+  // An undone action that was saved is redone past the save.
+  checkReplay([](Session& s) {
+    s.add(1);
+    s.add(2);
+    s.undo.undo();
+    s.save();
+    s.undo.redo();
+    s.undo.undo();
+    s.undo.redo();
+  });
+
+  // Saving twice, with edits on both sides of each save.
+  checkReplay([](Session& s) {
+    s.add(1);
+    s.save();
+    s.add(2);
+    s.save();
+    s.add(3);
+    s.undo.undo();
+    s.undo.undo();
+    s.undo.undo();
+    s.undo.redo();
+  });
+
+  // Edits made while the save is written are kept by the new base, whether
+  // or not the file has them yet.
+  for (bool written : { false, true }) {
+    checkReplay([&](Session& s) {
+      s.add(1);
+      s.journal.sync();
+      s.add(2);
+      size_t position = s.beginSave();
+      s.add(3);
+      s.undo.undo();
+      s.undo.undo();
+      if (written) s.journal.sync();
+      s.finishSave(position);
+      s.add(4);
+    });
+  }
+
+  // The terrain of a new map is kept in the base.
+  {
+    ActionJournal journal;
+    ActionJournal::Base base;
+    base.tile_width = 2;
+    base.tile_height = 2;
+    base.tiles = { 1, 2, 3, 4 };
+    journal.setBase(base);
+    journal.recordUndo();
+    journal.sync();
+    for (auto& entry : std::filesystem::directory_iterator(journal_dir())) {
+      if (entry.path().extension() != ".journal") continue;
+      auto read = ActionJournal::readBase(entry.path());
+      CHECK(read && read->tiles == base.tiles);
+    }
+  }
+}
@@ -0,0 +1,46 @@
+#include "tests.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <QCoreApplication>
+#include <QStandardPaths>
+
+namespace {
+  int failures = 0;
+}
+
+bool ChkForge::Tests::check(bool ok, const char* expr, const char* file, int line)
+{
+  if (!ok) {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    ++failures;
+  }
+  return ok;
+}
+
+// usage: ChkForgeTests
+//        ChkForgeTests --bench-finder N
+//
+// Runs the checks of the parts of ChkForge that work without a map loaded,
+// and exits with a non-zero status if any of them failed.
+//
+// --bench-finder times adding, removing and querying N units of assorted
+// sizes, spread over the largest map, in the editor's unit finder. It needs
+// no game data.
+int main(int argc, char* argv[])
+{
+  if (argc == 3 && strcmp(argv[1], "--bench-finder") == 0) return ChkForge::Tests::benchUnitFinder(std::atoi(argv[2]));
+
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("ChkForgeTests");
+  // Keeps journals and settings away from those of ChkForge itself.
+  QStandardPaths::setTestModeEnabled(true);
+
+  ChkForge::Tests::journalTests();
+  ChkForge::Tests::unitFinderTests();
+
+  if (failures) fprintf(stderr, "%d checks failed\n", failures);
+  else printf("all checks passed\n");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+namespace ChkForge::Tests {
+  // Counts and reports a failed check without stopping the run.
+  bool check(bool ok, const char* expr, const char* file, int line);
+
+  void journalTests();
+  void unitFinderTests();
+
+  // Times the unit finder over count units, see main.
+  int benchUnitFinder(int count);
+}
+
+#define CHECK(expr) ChkForge::Tests::check((expr), #expr, __FILE__, __LINE__)
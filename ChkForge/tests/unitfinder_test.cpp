@@ -0,0 +1,150 @@
+#include "tests.h"
+#include "../UnitFinder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+using namespace bwgame;
+
+namespace bwgame {
+  // UnitFinder only needs the openbw types, but bwgame.h declares these.
+  global_state global_st;
+
+  namespace ui {
+    void log_str(a_string str) {
+      fwrite(str.data(), str.size(), 1, stderr);
+    }
+  }
+}
+
+namespace {
+  // Units of assorted sizes spread over the largest map, with no game data.
+  struct Units {
+    a_vector<unit_type_t> types;
+    a_vector<sprite_t> sprites;
+    a_vector<unit_t> units;
+    std::vector<unit_t*> ptrs;
+
+    Units(int count, std::mt19937& rng) : types(5), sprites(count), units(count) {
+      // Half sizes from a small unit to about the largest building.
+      for (size_t i = 0; i != types.size(); ++i) {
+        int size = 8 << i;
+        types[i].dimensions = { {size, size}, {size - 1, size - 1} };
+      }
+      std::uniform_int_distribution<int> coord(0, 256 * 32 - 1);
+      for (int i = 0; i != count; ++i) {
+        sprites[i].position = { coord(rng), coord(rng) };
+        units[i].sprite = &sprites[i];
+        units[i].unit_type = &types[rng() % types.size()];
+        units[i].index = i;
+        ptrs.push_back(&units[i]);
+      }
+    }
+  };
+
+  std::vector<unit_t*> findAll(const std::vector<unit_t*>& units, const rect& r) {
+    std::vector<unit_t*> result;
+    for (unit_t* u : units) {
+      rect dim = { u->sprite->position - u->unit_type->dimensions.from, u->sprite->position + u->unit_type->dimensions.to };
+      if (dim.from.x > r.to.x || dim.to.x < r.from.x || dim.from.y > r.to.y || dim.to.y < r.from.y) continue;
+      result.push_back(u);
+    }
+    return result;
+  }
+}
+
+void ChkForge::Tests::unitFinderTests()
+{
+  std::mt19937 rng(1);
+  Units units(2000, rng);
+  UnitFinder finder;
+  finder.add(units.ptrs);
+
+  // Every other unit is removed, the rest have to stay findable.
+  std::vector<unit_t*> kept;
+  for (size_t i = 0; i != units.ptrs.size(); ++i) {
+    if (i % 2) finder.remove(units.ptrs[i]);
+    else kept.push_back(units.ptrs[i]);
+  }
+
+  std::uniform_int_distribution<int> coord(-64, 256 * 32 + 64);
+  std::uniform_int_distribution<int> size(0, 640);
+  std::vector<unit_t*> found;
+  for (int i = 0; i != 2000; ++i) {
+    xy from = { coord(rng), coord(rng) };
+    rect r = { from, from + xy(size(rng), size(rng)) };
+    finder.find(r.from.x, r.from.y, r.to.x, r.to.y, found);
+    auto expected = findAll(kept, r);
+    std::sort(found.begin(), found.end());
+    std::sort(expected.begin(), expected.end());
+    CHECK(found == expected);
+  }
+
+  finder.clear();
+  finder.find(0, 0, 256 * 32, 256 * 32, found);
+  CHECK(found.empty());
+}
+
+int ChkForge::Tests::benchUnitFinder(int count)
+{
+  using clock = std::chrono::steady_clock;
+  const int rounds = 100;
+  const int query_count = 100000;
+  auto ns = [&](clock::duration d, int n) {
+    return std::chrono::duration<double, std::nano>(d).count() / n;
+  };
+
+  std::mt19937 rng(1);
+  Units units(count, rng);
+  std::uniform_int_distribution<int> coord(0, 256 * 32 - 1);
+  a_vector<rect> points(query_count);
+  a_vector<rect> rects(query_count);
+  for (int i = 0; i != query_count; ++i) {
+    xy pos = { coord(rng), coord(rng) };
+    points[i] = { pos, pos };
+    rects[i] = { pos, pos + xy(640, 480) };
+  }
+
+  UnitFinder finder;
+  clock::duration add{};
+  clock::duration add_all{};
+  clock::duration remove{};
+  clock::duration remove_all{};
+  for (int r = 0; r != rounds; ++r) {
+    auto t0 = clock::now();
+    for (unit_t* u : units.ptrs) finder.add(u);
+    auto t1 = clock::now();
+    for (unit_t* u : units.ptrs) finder.remove(u);
+    auto t2 = clock::now();
+    finder.add(units.ptrs);
+    auto t3 = clock::now();
+    finder.remove(units.ptrs);
+    auto t4 = clock::now();
+    add += t1 - t0;
+    remove += t2 - t1;
+    add_all += t3 - t2;
+    remove_all += t4 - t3;
+  }
+
+  finder.add(units.ptrs);
+  std::vector<unit_t*> result;
+  size_t found = 0;
+  auto query = [&](const a_vector<rect>& queries) {
+    auto t0 = clock::now();
+    for (const rect& q : queries) {
+      finder.find(q.from.x, q.from.y, q.to.x, q.to.y, result);
+      found += result.size();
+    }
+    return clock::now() - t0;
+  };
+  auto point = query(points);
+  auto screen = query(rects);
+
+  printf("%d units\n", count);
+  printf("add %.1fns\tremove %.1fns\tadd all %.1fns/unit\tremove all %.1fns/unit\n",
+    ns(add, rounds * count), ns(remove, rounds * count), ns(add_all, rounds * count), ns(remove_all, rounds * count));
+  printf("point query %.1fns\t640x480 query %.1fns\t(%zu found)\n", ns(point, query_count), ns(screen, query_count), found);
+  return 0;
+}
@@ -0,0 +1,399 @@
+// Headless batch runner: simulates maps and replays without any UI, spread
+// over all cores, and prints per-file speed and final state hash.
+//
+// usage: openbw_batch --data <starcraft dir> [--frames N] [--threads N] [--list file]
+//                     [--hash-interval N --hash-dir dir] files...
+//        openbw_batch --diff <a.hashes> <b.hashes>
+//        openbw_batch --data <starcraft dir> --bench N maps...
+//        openbw_batch --data <starcraft dir> --verify-triggers [--frames N] [--threads N] [--list file] files...
+//
+// Replays run to their end frame (or N frames if given). Maps (.scx, .scm, .chk)
+// have no end and run for N frames, 10000 by default.
+//
+// With --hash-dir, a state hash stream sampled every --hash-interval frames is
+// written to <dir>/<file name>.hashes. --diff compares two such streams and
+// reports the first frame and subsystems that diverge.
+//
+// --bench loads each map N times on a single thread and reports the average
+// time to load it, to copy the loaded state and to reset it. Compare a build
+// with OPENBW_ARENA_ALLOCATOR defined against one without to measure the
+// state arena.
+//
+// --verify-triggers runs each file twice side by side, once with the compiled
+// trigger programs and once with the trigger interpreter, and fails it at the
+// first frame where the state hashes or the trigger state differ. The compiled
+// run also checks every trigger condition against the interpreter. Only the
+// conditions and actions used by the given maps and replays are covered.
+
+#include "../bwglobal.h"
+#include "../openbw/bwgame.h"
+#include "../openbw/replay.h"
+#include "../openbw/state_hash.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace bwgame {
+
+global_state global_st;
+
+namespace ui {
+
+std::mutex log_mutex;
+
+void log_str(a_string str) {
+	std::lock_guard<std::mutex> l(log_mutex);
+	fwrite(str.data(), str.size(), 1, stderr);
+	fflush(stderr);
+}
+
+}
+
+}
+
+using namespace bwgame;
+
+namespace {
+
+struct run_result {
+	a_string filename;
+	int frames = 0;
+	double seconds = 0.0;
+	uint32_t hash = 0;
+	a_string error;
+};
+
+bool has_extension(const a_string& filename, const char* ext) {
+	size_t n = strlen(ext);
+	if (filename.size() < n) return false;
+	for (size_t i = 0; i != n; ++i) {
+		if (tolower((unsigned char)filename[filename.size() - n + i]) != ext[i]) return false;
+	}
+	return true;
+}
+
+struct run_options {
+	int frame_limit = 0;
+	int hash_interval = 0;
+	a_string hash_dir;
+	bool verify_triggers = false;
+};
+
+template<typename player_T, typename is_done_F>
+void run_frames(player_T& player, const run_options& options, int frame_limit, is_done_F&& is_done, run_result& r) {
+	state_hash_stream_writer hash_stream;
+	if (!options.hash_dir.empty()) {
+		a_string name = r.filename;
+		size_t slash = name.find_last_of("/\\");
+		if (slash != a_string::npos) name = name.substr(slash + 1);
+		hash_stream.open(options.hash_dir + "/" + name + ".hashes", options.hash_interval);
+		hash_stream.update(player.st());
+	}
+	auto start = std::chrono::steady_clock::now();
+	int start_frame = player.st().current_frame;
+	while (!is_done() && (!frame_limit || player.st().current_frame < frame_limit)) {
+		player.next_frame();
+		hash_stream.update(player.st());
+	}
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	r.frames = player.st().current_frame - start_frame;
+	r.hash = state_hasher::hash(player.st()).combined();
+}
+
+void set_trigger_programs(game_player& player, bool compiled) {
+	player.funcs().use_trigger_programs = compiled;
+	player.funcs().verify_trigger_programs = compiled;
+}
+
+void set_trigger_programs(replay_player& player, bool compiled) {
+	player.lazy_init();
+	player.opt_funcs->use_trigger_programs = compiled;
+	player.opt_funcs->verify_trigger_programs = compiled;
+}
+
+// What the trigger actions leave behind that state_hasher does not cover.
+uint32_t hash_trigger_state(const state& st) {
+	state_hasher::fnv1a h;
+	for (auto& running : st.running_triggers) {
+		for (auto& rt : running) {
+			h.add(rt.flags);
+			h.add((uint32_t)rt.current_action_index);
+			for (auto& a : rt.actions) h.add(a.flags);
+		}
+		h.add(0xffffffffu);
+	}
+	for (size_t i = 0; i != 12; ++i) {
+		h.add(st.trigger_waiting[i]);
+		h.add(st.trigger_wait_timers[i]);
+	}
+	return h.hash;
+}
+
+template<typename player_T, typename is_done_F>
+void verify_trigger_frames(player_T& compiled, player_T& interpreted, int frame_limit, is_done_F&& is_done, run_result& r) {
+	set_trigger_programs(compiled, true);
+	set_trigger_programs(interpreted, false);
+	auto start = std::chrono::steady_clock::now();
+	int start_frame = compiled.st().current_frame;
+	while (!is_done() && (!frame_limit || compiled.st().current_frame < frame_limit)) {
+		compiled.next_frame();
+		interpreted.next_frame();
+		auto d = diff_state_hash_streams({state_hasher::hash(compiled.st())}, {state_hasher::hash(interpreted.st())});
+		if (d.diverged) r.error = "trigger programs: " + d.message;
+		else if (hash_trigger_state(compiled.st()) != hash_trigger_state(interpreted.st())) {
+			r.error = format("trigger programs: first divergence at frame %d in running triggers", compiled.st().current_frame);
+		}
+		if (!r.error.empty()) break;
+	}
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	r.frames = compiled.st().current_frame - start_frame;
+	r.hash = state_hasher::hash(compiled.st()).combined();
+}
+
+void load_map(game_load_functions& game_load_funcs, const a_string& filename) {
+	if (has_extension(filename, ".chk")) {
+		data_loading::file_reader<> file_r(filename);
+		auto data = file_r.get_vec<uint8_t>(file_r.size());
+		game_load_funcs.load_map_data(data.data(), data.size());
+	} else {
+		game_load_funcs.load_map_file(filename);
+	}
+}
+
+run_result run_file(const a_string& filename, const run_options& options) {
+	int frame_limit = options.frame_limit;
+	run_result r;
+	r.filename = filename;
+	try {
+		if (has_extension(filename, ".rep")) {
+			replay_player player;
+			player.load_replay_file(filename);
+			if (options.verify_triggers) {
+				replay_player interpreted;
+				interpreted.load_replay_file(filename);
+				verify_trigger_frames(player, interpreted, frame_limit, [&]() { return player.is_done(); }, r);
+			} else {
+				run_frames(player, options, frame_limit, [&]() { return player.is_done(); }, r);
+			}
+		} else {
+			game_player player;
+			game_load_functions game_load_funcs(player.st());
+			load_map(game_load_funcs, filename);
+			if (options.verify_triggers) {
+				game_player interpreted;
+				game_load_functions interpreted_load_funcs(interpreted.st());
+				load_map(interpreted_load_funcs, filename);
+				verify_trigger_frames(player, interpreted, frame_limit ? frame_limit : 10000, []() { return false; }, r);
+			} else {
+				run_frames(player, options, frame_limit ? frame_limit : 10000, []() { return false; }, r);
+			}
+		}
+	} catch (const std::exception& e) {
+		r.error = e.what();
+	}
+	return r;
+}
+
+int bench(const a_vector<a_string>& files, int iterations) {
+	using clock = std::chrono::steady_clock;
+	auto ms = [&](clock::duration d) {
+		return std::chrono::duration<double, std::milli>(d).count() / iterations;
+	};
+#ifdef OPENBW_ARENA_ALLOCATOR
+	printf("allocator: arena\n");
+#else
+	printf("allocator: heap\n");
+#endif
+	int failed_count = 0;
+	for (auto& filename : files) {
+		clock::duration load{};
+		clock::duration copy{};
+		clock::duration reset{};
+		try {
+			for (int i = 0; i != iterations; ++i) {
+				auto t0 = clock::now();
+				game_player player;
+				game_load_functions game_load_funcs(player.st());
+				load_map(game_load_funcs, filename);
+				auto t1 = clock::now();
+				load += t1 - t0;
+				{
+					memory_arena snapshot_arena;
+					arena_scope scope(&snapshot_arena);
+					state snapshot = copy_state(player.st());
+					copy += clock::now() - t1;
+				}
+				auto t2 = clock::now();
+				{
+					arena_scope scope(player.arena());
+					player.st() = state();
+				}
+				reset += clock::now() - t2;
+			}
+			printf("%s\tload %.3fms\tcopy %.3fms\treset %.3fms\n", filename.c_str(), ms(load), ms(copy), ms(reset));
+		} catch (const std::exception& e) {
+			printf("%s\terror: %s\n", filename.c_str(), e.what());
+			++failed_count;
+		}
+		fflush(stdout);
+	}
+	return failed_count ? 1 : 0;
+}
+
+// Each worker owns a deque of jobs; it takes from the front of its own and
+// steals from the back of the others once it runs dry.
+struct work_queues {
+	struct queue_t {
+		std::mutex mut;
+		std::deque<size_t> jobs;
+	};
+	a_vector<queue_t> queues;
+
+	explicit work_queues(size_t n) : queues(n) {}
+
+	bool pop(size_t worker, size_t& job) {
+		{
+			auto& q = queues[worker];
+			std::lock_guard<std::mutex> l(q.mut);
+			if (!q.jobs.empty()) {
+				job = q.jobs.front();
+				q.jobs.pop_front();
+				return true;
+			}
+		}
+		for (size_t i = 1; i != queues.size(); ++i) {
+			auto& q = queues[(worker + i) % queues.size()];
+			std::lock_guard<std::mutex> l(q.mut);
+			if (!q.jobs.empty()) {
+				job = q.jobs.back();
+				q.jobs.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+void print_result(const run_result& r) {
+	double fps = r.seconds > 0 ? r.frames / r.seconds : 0.0;
+	if (r.error.empty()) {
+		printf("%s\t%d\t%.3f\t%.0f\t%08x\tok\n", r.filename.c_str(), r.frames, r.seconds, fps, r.hash);
+	} else {
+		printf("%s\t%d\t%.3f\t%.0f\t%08x\terror: %s\n", r.filename.c_str(), r.frames, r.seconds, fps, r.hash, r.error.c_str());
+	}
+	fflush(stdout);
+}
+
+int usage() {
+	fprintf(stderr, "usage: openbw_batch --data <starcraft dir> [--frames N] [--threads N] [--list file] [--hash-interval N --hash-dir dir] files...\n");
+	fprintf(stderr, "       openbw_batch --diff <a.hashes> <b.hashes>\n");
+	fprintf(stderr, "       openbw_batch --data <starcraft dir> --bench N maps...\n");
+	fprintf(stderr, "       openbw_batch --data <starcraft dir> --verify-triggers [--frames N] [--threads N] [--list file] files...\n");
+	return 2;
+}
+
+int diff(const a_string& a, const a_string& b) {
+	try {
+		auto r = diff_state_hash_streams(read_state_hash_stream(a), read_state_hash_stream(b));
+		printf("%s\n", r.message.c_str());
+		return r.diverged ? 1 : 0;
+	} catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+}
+
+}
+
+int main(int argc, char** argv) {
+
+	if (argc == 4 && a_string(argv[1]) == "--diff") return diff(argv[2], argv[3]);
+
+	a_string data_dir;
+	run_options options;
+	size_t thread_count = std::thread::hardware_concurrency();
+	int bench_iterations = 0;
+	a_vector<a_string> files;
+
+	for (int i = 1; i < argc; ++i) {
+		a_string arg = argv[i];
+		auto next = [&]() -> a_string {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "missing value for %s\n", arg.c_str());
+				exit(usage());
+			}
+			return argv[++i];
+		};
+		if (arg == "--data") data_dir = next();
+		else if (arg == "--frames") options.frame_limit = std::atoi(next().c_str());
+		else if (arg == "--hash-interval") options.hash_interval = std::atoi(next().c_str());
+		else if (arg == "--hash-dir") options.hash_dir = next();
+		else if (arg == "--threads") thread_count = (size_t)std::atoi(next().c_str());
+		else if (arg == "--bench") bench_iterations = std::atoi(next().c_str());
+		else if (arg == "--verify-triggers") options.verify_triggers = true;
+		else if (arg == "--list") {
+			a_string list_filename = next();
+			FILE* f = fopen(list_filename.c_str(), "r");
+			if (!f) {
+				fprintf(stderr, "failed to open %s\n", list_filename.c_str());
+				return 1;
+			}
+			char buf[4096];
+			while (fgets(buf, sizeof(buf), f)) {
+				a_string line = buf;
+				while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
+				if (!line.empty()) files.push_back(std::move(line));
+			}
+			fclose(f);
+		} else if (!arg.empty() && arg[0] == '-') return usage();
+		else files.push_back(std::move(arg));
+	}
+	if (data_dir.empty() || files.empty()) return usage();
+	if (thread_count == 0) thread_count = 1;
+
+	try {
+		auto load_data_file = data_loading::data_files_directory(data_dir);
+		global_st.init(load_data_file);
+	} catch (const std::exception& e) {
+		fprintf(stderr, "failed to load game data from %s: %s\n", data_dir.c_str(), e.what());
+		return 1;
+	}
+	if (bench_iterations > 0) return bench(files, bench_iterations);
+
+	work_queues queues(thread_count);
+	for (size_t i = 0; i != files.size(); ++i) {
+		queues.queues[i % thread_count].jobs.push_back(i);
+	}
+
+	std::mutex output_mutex;
+	std::atomic<size_t> failed_count{0};
+	std::atomic<uint64_t> total_frames{0};
+	auto start = std::chrono::steady_clock::now();
+
+	a_vector<std::thread> threads;
+	for (size_t t = 0; t != thread_count; ++t) {
+		threads.emplace_back([&, t]() {
+			size_t job;
+			while (queues.pop(t, job)) {
+				auto r = run_file(files[job], options);
+				if (!r.error.empty()) ++failed_count;
+				total_frames += r.frames;
+				std::lock_guard<std::mutex> l(output_mutex);
+				print_result(r);
+			}
+		});
+	}
+	for (auto& v : threads) v.join();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%d files, %d failed, %llu frames in %.3fs (%.0f frames/s) on %d threads\n",
+		(int)files.size(), (int)failed_count, (unsigned long long)total_frames, seconds,
+		seconds > 0 ? total_frames / seconds : 0.0, (int)thread_count);
+
+	return failed_count ? 1 : 0;
+}
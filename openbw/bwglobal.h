@@ -3,6 +3,9 @@
 #define OPENBW_GLOBALS_H
 
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 
 #include "openbw/data_types.h"
 #include "openbw/game_types.h"
@@ -18,6 +21,7 @@ namespace bwgame {
 	grp.width = r.template get<uint16_t>();
 	grp.height = r.template get<uint16_t>();
 	grp.frames.resize(frame_count);
+	a_vector<std::pair<size_t, size_t>> frame_arena_offsets(frame_count);
 	for (size_t i = 0; i != frame_count; ++i) {
 	  auto& f = grp.frames[i];
 	  f.offset.x = r.template get<uint8_t>();
@@ -27,41 +31,170 @@ namespace bwgame {
 	  size_t file_offset = r.template get<uint32_t>();
 	  auto line_offset_r = base_r;
 	  line_offset_r.skip(file_offset);
-	  f.line_data_offset.reserve(f.size.y);
+	  size_t data_begin = grp.line_data.size();
+	  frame_arena_offsets[i] = { grp.line_data_offsets.size(), data_begin };
+	  auto& data = grp.line_data;
 	  for (size_t y = 0; y != f.size.y; ++y) {
 		auto line_r = base_r;
 		line_r.skip(file_offset + line_offset_r.template get<uint16_t>());
-		f.line_data_offset.push_back(f.data_container.size());
+		grp.line_data_offsets.push_back((uint32_t)(data.size() - data_begin));
 		for (size_t x = 0; x != f.size.x;) {
 		  auto v = line_r.template get<uint8_t>();
 		  if (v & 0x80) {
 			v &= 0x7f;
 			if (v > f.size.x - x) v = (uint8_t)(f.size.x - x);
-			f.data_container.push_back(0x80 | v);
+			data.push_back(0x80 | v);
 			x += v;
 		  }
 		  else if (v & 0x40) {
 			v &= 0x3f;
 			if (v > f.size.x - x) v = (uint8_t)(f.size.x - x);
-			f.data_container.push_back(0x40 | v);
-			f.data_container.push_back(line_r.template get<uint8_t>());
+			data.push_back(0x40 | v);
+			data.push_back(line_r.template get<uint8_t>());
 			x += v;
 		  }
 		  else {
 			if (v > f.size.x - x) v = (uint8_t)(f.size.x - x);
-			f.data_container.push_back(v);
+			data.push_back(v);
 			for (size_t i = 0; i != v; ++i) {
-			  f.data_container.push_back(line_r.template get<uint8_t>());
+			  data.push_back(line_r.template get<uint8_t>());
 			}
 			x += v;
 		  }
 		}
 	  }
-	  f.data_container.shrink_to_fit();
+	}
+	grp.line_data_offsets.shrink_to_fit();
+	grp.line_data.shrink_to_fit();
+	for (size_t i = 0; i != frame_count; ++i) {
+	  grp.frames[i].line_data_offset = grp.line_data_offsets.data() + frame_arena_offsets[i].first;
+	  grp.frames[i].data = grp.line_data.data() + frame_arena_offsets[i].second;
 	}
 	return grp;
   }
 
+  // Decodes every instruction reachable from the animation entry points. Operands
+  // are read exactly as iscript_execute reads them, including opcodes it treats as
+  // having none; instructions whose operands would run past the end are left
+  // undecoded so that executing them still fails the same way.
+  inline void decode_iscript(iscript_t& iscript) {
+	using namespace iscript_opcodes;
+
+	// b: uint8, c: int8, w: uint16, s: uint8 count followed by that many uint16.
+	// A trailing 'j' marks the last operand as a jump target.
+	std::array<const char*, MAX> formats{};
+	for (auto& v : formats) v = "";
+	formats[opc_playfram] = "w";
+	formats[opc_playframtile] = "w";
+	formats[opc_sethorpos] = "c";
+	formats[opc_setvertpos] = "c";
+	formats[opc_setpos] = "cc";
+	formats[opc_wait] = "b";
+	formats[opc_waitrand] = "bb";
+	formats[opc_goto] = "wj";
+	formats[opc_imgol] = "wcc";
+	formats[opc_imgul] = "wcc";
+	formats[opc_imgolorig] = "w";
+	formats[opc_switchul] = "w";
+	formats[opc_imgoluselo] = "wcc";
+	formats[opc_sprol] = "wcc";
+	formats[opc_lowsprul] = "wcc";
+	formats[opc_spruluselo] = "wcc";
+	formats[opc_sprul] = "wcc";
+	formats[opc_sproluselo] = "wb";
+	formats[opc_setflipstate] = "b";
+	formats[opc_playsnd] = "w";
+	formats[opc_playsndrand] = "s";
+	formats[opc_playsndbtwn] = "ww";
+	formats[opc_attackmelee] = "s";
+	formats[opc_randcondjmp] = "bwj";
+	formats[opc_turnccwise] = "b";
+	formats[opc_turncwise] = "b";
+	formats[opc_turnrand] = "b";
+	formats[opc_sigorder] = "b";
+	formats[opc_attackwith] = "b";
+	formats[opc_useweapon] = "b";
+	formats[opc_move] = "b";
+	formats[opc_engframe] = "b";
+	formats[opc_engset] = "b";
+	formats[opc_attkshiftproj] = "b";
+	formats[opc_setfldirect] = "b";
+	formats[opc_setflspeed] = "w";
+	formats[opc_call] = "wj";
+	formats[opc_creategasoverlays] = "b";
+	formats[opc_pwrupcondjmp] = "wj";
+	formats[opc_trgtrangecondjmp] = "wwj";
+	formats[opc_trgtarccondjmp] = "wwwj";
+	formats[opc_curdirectcondjmp] = "wwwj";
+	formats[opc_imgulnextid] = "bb";
+	formats[opc_liftoffcondjmp] = "wj";
+	formats[opc_warpoverlay] = "w";
+	formats[opc_orderdone] = "b";
+	formats[opc_grdsprol] = "wcc";
+
+	const auto& data = iscript.data;
+	iscript.instructions.clear();
+	iscript.operands.clear();
+	iscript.instruction_at.assign(data.size(), iscript_t::no_instruction);
+
+	a_vector<size_t> pending;
+	for (auto& v : iscript.script_anim_offsets) {
+	  for (auto pc : v.second) pending.push_back(pc);
+	}
+
+	a_vector<int> operands;
+	while (!pending.empty()) {
+	  size_t pc = pending.back();
+	  pending.pop_back();
+	  while (pc < data.size() && iscript.instruction_at[pc] == iscript_t::no_instruction) {
+		data_loading::data_reader<true, false> r(data.data() + pc, data.data() + data.size());
+		int opcode = r.get<uint8_t>();
+		const char* format = opcode < MAX ? formats[opcode] : "";
+		operands.clear();
+		bool truncated = false;
+		bool jump = false;
+		for (const char* f = format; *f; ++f) {
+		  size_t size = *f == 'w' ? 2 : *f == 'j' ? 0 : 1;
+		  if (r.left() < size) {
+			truncated = true;
+			break;
+		  }
+		  if (*f == 'b') operands.push_back(r.get<uint8_t>());
+		  else if (*f == 'c') operands.push_back(r.get<int8_t>());
+		  else if (*f == 'w') operands.push_back(r.get<uint16_t>());
+		  else if (*f == 'j') jump = true;
+		  else if (*f == 's') {
+			size_t n = r.get<uint8_t>();
+			operands.push_back((int)n);
+			if (r.left() < n * 2) {
+			  truncated = true;
+			  break;
+			}
+			for (size_t i = 0; i != n; ++i) operands.push_back(r.get<uint16_t>());
+		  }
+		}
+		if (truncated) break;
+
+		iscript_t::instruction_t ins;
+		ins.opcode = opcode;
+		ins.operands_begin = (uint32_t)iscript.operands.size();
+		ins.next_pc = (uint32_t)(pc + r.tell());
+		ins.next = iscript_t::no_instruction;
+		iscript.operands.insert(iscript.operands.end(), operands.begin(), operands.end());
+		iscript.instruction_at[pc] = (uint32_t)iscript.instructions.size();
+		iscript.instructions.push_back(ins);
+
+		if (jump) pending.push_back((size_t)operands.back());
+		if (opcode == opc_goto) break;
+		pc = ins.next_pc;
+	  }
+	}
+
+	for (auto& v : iscript.instructions) {
+	  if (v.next_pc < data.size()) v.next = iscript.instruction_at[v.next_pc];
+	}
+  }
+
   struct global_state {
 
 	global_state() = default;
@@ -76,8 +209,19 @@ namespace bwgame {
 	order_types_t order_types;
 	iscript_t iscript;
 
+	// Grps are only read from the data files on first use through
+	// get_image_grp, using a copy of the loader passed to init. grps has one
+	// slot per distinct grp file, slot 0 being an empty grp for images
+	// without one.
 	a_vector<grp_t> grps;
-	a_vector<grp_t*> image_grp;
+	a_vector<a_string> grp_filenames;
+	a_vector<size_t> image_grp_index;
+	std::unique_ptr<std::once_flag[]> grps_once;
+	std::function<void(a_vector<uint8_t>&, a_string)> load_grp_file;
+	std::mutex load_grp_file_mutex;
+	std::mutex grp_prefetches_mutex;
+	a_vector<std::future<void>> grp_prefetches;
+
 	a_vector<a_vector<a_vector<xy>>> lo_offsets;
 	a_vector<std::array<a_vector<a_vector<xy>>*, 6>> image_lo_offsets;
 
@@ -95,8 +239,14 @@ namespace bwgame {
 	std::array<a_vector<vf4_entry>, 8> vf4;
 	std::array<a_vector<uint16_t>, 8>  mega_tile_flags;
 
+	// The per-tileset tables are built on first use, possibly from several
+	// games ticking on different threads at once.
+	std::array<std::once_flag, 8> cv5_once;
+	std::array<std::once_flag, 8> vf4_once;
+	std::array<std::once_flag, 8> mega_tile_flags_once;
+
 	a_vector<cv5_entry>& get_cv5(int tileset) {
-	  if (cv5.at(tileset).empty()) {
+	  std::call_once(cv5_once.at(tileset), [&]() {
 		auto& cv5_data = tileset_cv5.at(tileset);
 		data_loading::data_reader_le r(cv5_data.data(), cv5_data.data() + cv5_data.size());
 		cv5[tileset].reserve(cv5_data.size() / 52);
@@ -117,12 +267,12 @@ namespace bwgame {
 			e.mega_tile_index[i] = r.get<uint16_t>();
 		  }
 		}
-	  }
+	  });
 	  return cv5[tileset];
 	}
 
 	a_vector<vf4_entry>& get_vf4(int tileset) {
-	  if (vf4.at(tileset).empty()) {
+	  std::call_once(vf4_once.at(tileset), [&]() {
 		auto& vf4_data = tileset_vf4.at(tileset);
 		data_loading::data_reader_le r(vf4_data.data(), vf4_data.data() + vf4_data.size());
 		vf4[tileset].reserve(vf4_data.size() / 32);
@@ -133,12 +283,12 @@ namespace bwgame {
 			e.flags[i] = r.get<uint16_t>();
 		  }
 		}
-	  }
+	  });
 	  return vf4[tileset];
 	}
 
 	a_vector<uint16_t>& get_mega_tile_flags(int tileset) {
-	  if (mega_tile_flags.at(tileset).empty()) {
+	  std::call_once(mega_tile_flags_once.at(tileset), [&]() {
 		auto& vf4 = get_vf4(tileset);
 		mega_tile_flags[tileset].resize(vf4.size());
 		for (size_t i = 0; i < mega_tile_flags[tileset].size(); ++i) {
@@ -164,10 +314,59 @@ namespace bwgame {
 		  if (very_high_count) flags |= tile_t::flag_very_high;
 		  mega_tile_flags[tileset][i] = flags;
 		}
-	  }
+	  });
 	  return mega_tile_flags[tileset];
 	}
 
+	grp_t* get_image_grp(size_t image_id) {
+	  size_t index = image_grp_index.at(image_id);
+	  std::call_once(grps_once[index], [&]() {
+		if (index == 0) return;
+		a_vector<uint8_t> data;
+		{
+		  std::lock_guard<std::mutex> l(load_grp_file_mutex);
+		  load_grp_file(data, grp_filenames[index]);
+		}
+		grps[index] = read_grp(data_loading::data_reader_le(data.data(), data.data() + data.size()));
+	  });
+	  return &grps[index];
+	}
+
+	// Loads the grps of the given unit types, including their turrets and
+	// construction images, on a background thread.
+	void prefetch_unit_grps(const a_vector<int>& unit_type_ids) {
+	  auto unit_types = data_loading::load_units_dat(units_dat);
+	  a_vector<size_t> image_ids;
+	  auto add_unit_type = [&](int id) {
+		if (id < 0 || (size_t)id >= unit_types.vec.size()) return;
+		auto& ut = unit_types.vec[id];
+		auto& flingy_type = flingy_types.vec.at((size_t)(FlingyTypes)ut.flingy);
+		if (flingy_type.sprite && flingy_type.sprite->image) image_ids.push_back((size_t)flingy_type.sprite->image->id);
+		if ((ImageTypes)ut.construction_animation != ImageTypes::None) image_ids.push_back((size_t)(ImageTypes)ut.construction_animation);
+		if ((UnitTypes)ut.turret_unit_type != UnitTypes::None) {
+		  auto& turret = unit_types.vec.at((size_t)(UnitTypes)ut.turret_unit_type);
+		  auto& turret_flingy_type = flingy_types.vec.at((size_t)(FlingyTypes)turret.flingy);
+		  if (turret_flingy_type.sprite && turret_flingy_type.sprite->image) image_ids.push_back((size_t)turret_flingy_type.sprite->image->id);
+		}
+	  };
+	  for (int id : unit_type_ids) add_unit_type(id);
+
+	  std::lock_guard<std::mutex> l(grp_prefetches_mutex);
+	  for (auto i = grp_prefetches.begin(); i != grp_prefetches.end();) {
+		if (i->wait_for(std::chrono::seconds(0)) == std::future_status::ready) i = grp_prefetches.erase(i);
+		else ++i;
+	  }
+	  grp_prefetches.push_back(std::async(std::launch::async, [this, image_ids = std::move(image_ids)]() {
+		for (size_t id : image_ids) {
+		  // A grp that fails to load here fails again, and is reported, when it is first used.
+		  try {
+			get_image_grp(id);
+		  } catch (const std::exception&) {
+		  }
+		}
+	  }));
+	}
+
 	template<typename load_data_file_F>
 	void init(load_data_file_F&& load_data_file) {
 
@@ -214,11 +413,6 @@ namespace bwgame {
 		size_t file_count = r.get<uint16_t>();
 		(void)file_count;
 
-		auto load_grp = [&](data_reader_le r) {
-		  size_t index = grps.size();
-		  grps.push_back(read_grp(r));
-		  return index;
-		};
 		auto load_offsets = [&](data_reader_le r) {
 		  auto base_r = r;
 		  lo_offsets.emplace_back();
@@ -243,11 +437,7 @@ namespace bwgame {
 		  return lo_offsets.size() - 1;
 		};
 
-		a_unordered_map<size_t, size_t> loaded;
-		auto load = [&](int index, std::function<size_t(data_reader_le)> f) {
-		  if (!index) return (size_t)0;
-		  auto in = loaded.emplace(index, 0);
-		  if (!in.second) return in.first->second;
+		auto filename_at = [&](int index) {
 		  auto r = base_r;
 		  r.skip(2 + (index - 1) * 2);
 		  size_t fn_offset = r.get<uint16_t>();
@@ -255,24 +445,39 @@ namespace bwgame {
 		  r.skip(fn_offset);
 		  a_string fn;
 		  while (char c = r.get<char>()) fn += c;
+		  return format("unit\\%s", fn);
+		};
+
+		a_unordered_map<size_t, size_t> loaded;
+		auto load = [&](int index, std::function<size_t(data_reader_le)> f) {
+		  if (!index) return (size_t)0;
+		  auto in = loaded.emplace(index, 0);
+		  if (!in.second) return in.first->second;
 
 		  a_vector<uint8_t> data;
-		  load_data_file(data, format("unit\\%s", fn));
+		  load_data_file(data, filename_at(index));
 		  data_reader_le data_r(data.data(), data.data() + data.size());
 		  size_t loaded_index = f(data_r);
 		  in.first->second = loaded_index;
 		  return loaded_index;
 		};
 
-		a_vector<size_t> image_grp_index;
+		a_unordered_map<size_t, size_t> grp_slots;
+		auto add_grp = [&](int index) {
+		  if (!index) return (size_t)0;
+		  auto in = grp_slots.emplace(index, grp_filenames.size());
+		  if (in.second) grp_filenames.push_back(filename_at(index));
+		  return in.first->second;
+		};
+
 		std::array<a_vector<size_t>, 6> lo_indices;
 
-		grps.emplace_back(); // null/invalid entry
+		grp_filenames.emplace_back(); // null/invalid entry
 		lo_offsets.emplace_back();
 
 		for (size_t i = 0; i != 999; ++i) {
 		  const image_type_t* image_type = get_image_type((ImageTypes)i);
-		  image_grp_index.push_back(load(image_type->grp_filename_index, load_grp));
+		  image_grp_index.push_back(add_grp(image_type->grp_filename_index));
 		  lo_indices[0].push_back(load(image_type->attack_filename_index, load_offsets));
 		  lo_indices[1].push_back(load(image_type->damage_filename_index, load_offsets));
 		  lo_indices[2].push_back(load(image_type->special_filename_index, load_offsets));
@@ -281,10 +486,8 @@ namespace bwgame {
 		  lo_indices[5].push_back(load(image_type->shield_filename_index, load_offsets));
 		}
 
-		image_grp.resize(image_grp_index.size());
-		for (size_t i = 0; i != image_grp_index.size(); ++i) {
-		  image_grp[i] = &grps.at(image_grp_index[i]);
-		}
+		grps.resize(grp_filenames.size());
+		grps_once = std::make_unique<std::once_flag[]>(grps.size());
 		
 		image_lo_offsets.resize(999);
 		for (size_t i = 0; i != 6; ++i) {
@@ -330,7 +533,10 @@ namespace bwgame {
 		fixup_image_type(v.image);
 	  }
 
+	  load_grp_file = load_data_file;
+
 	  load_iscript_bin();
+	  decode_iscript(iscript);
 	  load_images();
 
 	  std::array<const char*, 8> tileset_names = {
@@ -6,6 +6,9 @@
 #include "openbw/data_loading.h"
 
 #include <chrono>
+#include <cstdlib>
+#include <future>
+#include <mutex>
 
 namespace bwgame {
   struct string_table_data {
@@ -27,7 +30,6 @@ namespace bwgame {
   struct vr4_entry {
 	using bitmap_t = std::conditional<is_native_fast_int<uint64_t>::value, uint64_t, uint32_t>::type;
 	std::array<bitmap_t, 64 / sizeof(bitmap_t)> bitmap;
-	std::array<bitmap_t, 64 / sizeof(bitmap_t)> inverted_bitmap;
   };
   struct vx4_entry {
 	std::array<uint16_t, 16> images;
@@ -61,6 +63,28 @@ namespace bwgame {
 	std::array<int, 0x100> creep_edge_frame_index{};
   };
 
+  static inline uint64_t byte_reverse(uint64_t v) {
+#if defined(_MSC_VER)
+	return _byteswap_uint64(v);
+#elif defined(__GNUC__)
+	return __builtin_bswap64(v);
+#else
+	v = (v & 0x00ff00ff00ff00ff) << 8 | (v >> 8 & 0x00ff00ff00ff00ff);
+	v = (v & 0x0000ffff0000ffff) << 16 | (v >> 16 & 0x0000ffff0000ffff);
+	return v << 32 | v >> 32;
+#endif
+  }
+  static inline uint32_t byte_reverse(uint32_t v) {
+#if defined(_MSC_VER)
+	return _byteswap_ulong(v);
+#elif defined(__GNUC__)
+	return __builtin_bswap32(v);
+#else
+	v = (v & 0x00ff00ff) << 8 | (v >> 8 & 0x00ff00ff);
+	return v << 16 | v >> 16;
+#endif
+  }
+
   template<bool bounds_check>
   void draw_tile(const tileset_image_data& img, size_t megatile_index, uint8_t* dst, size_t pitch, size_t offset_x, size_t offset_y, size_t width, size_t height) {
 	auto* images = &img.vx4.at(megatile_index).images[0];
@@ -70,19 +94,23 @@ namespace bwgame {
 	  for (size_t image_ix = 0; image_ix != 4; ++image_ix) {
 		auto image_index = *images;
 		bool inverted = (image_index & 1) == 1;
-		auto* bitmap = inverted ? &img.vr4.at(image_index / 2).inverted_bitmap[0] : &img.vr4.at(image_index / 2).bitmap[0];
+		auto* bitmap = &img.vr4.at(image_index / 2).bitmap[0];
+		const size_t n = 8 / sizeof(vr4_entry::bitmap_t);
 
 		for (size_t iy = 0; iy != 8; ++iy) {
-		  for (size_t iv = 0; iv != 8 / sizeof(vr4_entry::bitmap_t); ++iv) {
+		  for (size_t iv = 0; iv != n; ++iv) {
+			// Inverted minitiles are mirrored horizontally, which is the row
+			// with its bytes in reverse order.
+			auto v = inverted ? byte_reverse(bitmap[n - 1 - iv]) : bitmap[iv];
 			for (size_t b = 0; b != sizeof(vr4_entry::bitmap_t); ++b) {
 			  if (!bounds_check || (x >= offset_x && y >= offset_y && x < width && y < height)) {
-				*dst = (uint8_t)(*bitmap >> (8 * b));
+				*dst = (uint8_t)(v >> (8 * b));
 			  }
 			  ++dst;
 			  ++x;
 			}
-			++bitmap;
 		  }
+		  bitmap += n;
 		  x -= 8;
 		  ++y;
 		  dst -= 8;
@@ -122,7 +150,7 @@ namespace bwgame {
 	  if (flipped) dst += frame.size.x - 1;
 	  if (textured && flipped) texture += frame.size.x - 1;
 
-	  const uint8_t* d = frame.data_container.data() + frame.line_data_offset.at(y);
+	  const uint8_t* d = frame.line_data(y);
 	  for (size_t x = flipped ? frame.size.x - 1 : 0; x != (flipped ? (size_t)0 - 1 : frame.size.x);) {
 		int v = *d++;
 		if (v & 0x80) {
@@ -348,15 +376,11 @@ namespace bwgame {
 	img.vr4.resize(vr4_data.size() / 64);
 	for (size_t i = 0; i != img.vr4.size(); ++i) {
 	  for (size_t i2 = 0; i2 != 8; ++i2) {
-		auto r2 = vr4_r;
 		auto v = vr4_r.get<uint64_t, true>();
-		auto iv = r2.get<uint64_t, false>();
 		size_t n = 8 / sizeof(vr4_entry::bitmap_t);
 		for (size_t i3 = 0; i3 != n; ++i3) {
 		  img.vr4[i].bitmap[i2 * n + i3] = (vr4_entry::bitmap_t)v;
-		  img.vr4[i].inverted_bitmap[i2 * n + i3] = (vr4_entry::bitmap_t)iv;
 		  v >>= n == 1 ? 0 : 8 * sizeof(vr4_entry::bitmap_t);
-		  iv >>= n == 1 ? 0 : 8 * sizeof(vr4_entry::bitmap_t);
 		}
 	  }
 	}
@@ -424,7 +448,10 @@ namespace bwgame {
 
 	grp_t cmdicons;
 	image_data img;
+	// Only loaded on first use through get_tileset_img, as few sessions use
+	// more than one or two tilesets.
 	std::array<tileset_image_data, 8> all_tileset_img;
+	std::array<std::once_flag, 8> all_tileset_img_once;
 
 	a_vector<uint8_t> creep_random_tile_indices = a_vector<uint8_t>(256 * 256);
 
@@ -435,11 +462,16 @@ namespace bwgame {
 	a_vector<bool> has_loaded_sound;
 	a_vector<std::unique_ptr<native_sound::sound>> loaded_sounds;
 	a_vector<std::chrono::high_resolution_clock::time_point> last_played_sound;
+	// Guards the sound state above and sound_channels, which play_sound
+	// updates from whichever thread is running the game.
+	std::mutex sound_mutex;
 
 	int global_volume = 50;
 
 
 	std::function<void(a_vector<uint8_t>&, a_string)> load_data_file;
+	std::mutex tileset_img_preloads_mutex;
+	a_vector<std::future<void>> tileset_img_preloads;
 
 	void draw_icon(int icon_id, uint8_t* dst, size_t pitch, size_t width, size_t height) {
 	  if (icon_id >= cmdicons.frames.size()) return;
@@ -459,6 +491,8 @@ namespace bwgame {
 
 	template<typename load_data_file_F>
 	void init(load_data_file_F&& load_data_file) {
+	  this->load_data_file = load_data_file;
+
 	  uint32_t rand_state = (uint32_t)std::chrono::high_resolution_clock::now().time_since_epoch().count();
 	  auto rand = [&]() {
 		rand_state = rand_state * 22695477 + 1;
@@ -497,9 +531,30 @@ namespace bwgame {
 	  cmdicons = read_grp(data_loading::data_reader_le(grp_data.data(), grp_data.data() + grp_data.size()));
 
 	  load_image_data(img, load_data_file);
-	  for (size_t i = 0; i != 8; ++i) {
-		load_tileset_image_data(all_tileset_img[i], i, load_data_file);
+	}
+
+	const tileset_image_data& get_tileset_img(size_t tileset_index) {
+	  std::call_once(all_tileset_img_once.at(tileset_index), [&]() {
+		load_tileset_image_data(all_tileset_img[tileset_index], tileset_index, load_data_file);
+	  });
+	  return all_tileset_img[tileset_index];
+	}
+
+	// Loads a tileset on a background thread, so it is likely ready by the
+	// time get_tileset_img is called. load_data_file must be thread-safe.
+	void preload_tileset_img(size_t tileset_index) {
+	  std::lock_guard<std::mutex> l(tileset_img_preloads_mutex);
+	  for (auto i = tileset_img_preloads.begin(); i != tileset_img_preloads.end();) {
+		if (i->wait_for(std::chrono::seconds(0)) == std::future_status::ready) i = tileset_img_preloads.erase(i);
+		else ++i;
 	  }
+	  tileset_img_preloads.push_back(std::async(std::launch::async, [this, tileset_index]() {
+		// A tileset that fails to load here fails again, and is reported, when it is first used.
+		try {
+		  get_tileset_img(tileset_index);
+		} catch (const std::exception&) {
+		}
+	  }));
 	}
 
 
@@ -521,6 +576,7 @@ namespace bwgame {
 	void set_volume(int volume) {
 	  if (volume < 0) volume = 0;
 	  else if (volume > 100) volume = 100;
+	  std::lock_guard<std::mutex> l(sound_mutex);
 	  global_volume = volume;
 	  for (auto& c : sound_channels) {
 		if (c.playing) {
@@ -0,0 +1,150 @@
+#ifndef BWGAME_ARENA_H
+#define BWGAME_ARENA_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace bwgame {
+
+// Memory for the containers of one game state. Small blocks are carved out
+// of large chunks and recycled through per-size free lists when the state
+// frees them; the chunks are only returned to the heap, all at once, when
+// the arena is destroyed. Large blocks go straight to the heap. Not
+// thread-safe; a state must only be used by one thread at a time anyway.
+struct memory_arena : std::pmr::memory_resource {
+	static const size_t granularity = 16;
+	static const size_t max_small_size = 4096;
+	static const size_t chunk_size = 256 * 1024;
+
+	struct free_block {
+		free_block* next;
+	};
+	std::array<free_block*, max_small_size / granularity> free_lists{};
+	std::vector<void*> chunks;
+	uint8_t* chunk_pos = nullptr;
+	uint8_t* chunk_end = nullptr;
+
+	memory_arena() = default;
+	memory_arena(const memory_arena&) = delete;
+	memory_arena& operator=(const memory_arena&) = delete;
+	~memory_arena() {
+		for (void* p : chunks) ::operator delete(p);
+	}
+
+	std::pmr::memory_resource* get() {
+		return this;
+	}
+
+private:
+	static bool is_small(size_t bytes, size_t alignment) {
+		return bytes <= max_small_size && alignment <= granularity;
+	}
+
+	void* do_allocate(size_t bytes, size_t alignment) override {
+		if (!is_small(bytes, alignment)) return ::operator new(bytes, std::align_val_t(alignment));
+		if (bytes == 0) bytes = 1;
+		size_t index = (bytes - 1) / granularity;
+		if (free_block* b = free_lists[index]) {
+			free_lists[index] = b->next;
+			return b;
+		}
+		size_t size = (index + 1) * granularity;
+		if ((size_t)(chunk_end - chunk_pos) < size) {
+			chunks.reserve(chunks.size() + 1);
+			chunk_pos = (uint8_t*)::operator new(chunk_size);
+			chunk_end = chunk_pos + chunk_size;
+			chunks.push_back(chunk_pos);
+		}
+		void* r = chunk_pos;
+		chunk_pos += size;
+		return r;
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+		if (!is_small(bytes, alignment)) return ::operator delete(p, std::align_val_t(alignment));
+		if (bytes == 0) bytes = 1;
+		size_t index = (bytes - 1) / granularity;
+		free_block* b = (free_block*)p;
+		b->next = free_lists[index];
+		free_lists[index] = b;
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+		return this == &other;
+	}
+};
+
+static inline std::pmr::memory_resource*& current_memory_resource_ptr() {
+	thread_local std::pmr::memory_resource* r = nullptr;
+	return r;
+}
+
+static inline std::pmr::memory_resource* current_memory_resource() {
+	auto* r = current_memory_resource_ptr();
+	return r ? r : std::pmr::new_delete_resource();
+}
+
+// Containers created on this thread while the scope is alive allocate from
+// the given arena, for as long as they live. Containers created outside of
+// any scope use the heap.
+struct arena_scope {
+	std::pmr::memory_resource* prev;
+	explicit arena_scope(memory_arena* arena) : prev(current_memory_resource_ptr()) {
+		if (arena) current_memory_resource_ptr() = arena->get();
+	}
+	arena_scope(const arena_scope&) = delete;
+	arena_scope& operator=(const arena_scope&) = delete;
+	~arena_scope() {
+		current_memory_resource_ptr() = prev;
+	}
+};
+
+// The allocator bwgame::alloc refers to when OPENBW_ARENA_ALLOCATOR is
+// defined. It binds to the current arena when it is default constructed,
+// which is when a container is created. Copies of a container bind to the
+// arena current where the copy is made, while moves keep their source's
+// arena, so a container moved out of a state must not outlive the state's
+// arena.
+template<typename T>
+struct arena_allocator {
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::false_type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+	using is_always_equal = std::false_type;
+
+	std::pmr::memory_resource* resource;
+
+	arena_allocator() noexcept : resource(current_memory_resource()) {}
+	template<typename U>
+	arena_allocator(const arena_allocator<U>& other) noexcept : resource(other.resource) {}
+
+	T* allocate(size_t n) {
+		return (T*)resource->allocate(n * sizeof(T), alignof(T));
+	}
+	void deallocate(T* p, size_t n) noexcept {
+		resource->deallocate(p, n * sizeof(T), alignof(T));
+	}
+
+	arena_allocator select_on_container_copy_construction() const {
+		return arena_allocator();
+	}
+
+	template<typename U>
+	bool operator==(const arena_allocator<U>& other) const noexcept {
+		return resource == other.resource;
+	}
+	template<typename U>
+	bool operator!=(const arena_allocator<U>& other) const noexcept {
+		return resource != other.resource;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef BWGAME_ASSET_CACHE_H
+#define BWGAME_ASSET_CACHE_H
+
+#include "util.h"
+#include "containers.h"
+#include "data_loading.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bwgame {
+namespace data_loading {
+
+// Read-only memory mapping of a whole file.
+struct mapped_file {
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE h_file = INVALID_HANDLE_VALUE;
+	HANDLE h_mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+
+	mapped_file() = default;
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+	~mapped_file() {
+		close();
+	}
+
+	bool open(const a_string& filename) {
+		close();
+#ifdef _WIN32
+		h_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (h_file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(h_file, &file_size) || file_size.QuadPart == 0) {
+			close();
+			return false;
+		}
+		h_mapping = CreateFileMappingA(h_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!h_mapping) {
+			close();
+			return false;
+		}
+		data = (const uint8_t*)MapViewOfFile(h_mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!data) {
+			close();
+			return false;
+		}
+		size = (size_t)file_size.QuadPart;
+#else
+		fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd == -1) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			close();
+			return false;
+		}
+		void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close();
+			return false;
+		}
+		data = (const uint8_t*)p;
+		size = (size_t)st.st_size;
+#endif
+		return true;
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (h_mapping) CloseHandle(h_mapping);
+		if (h_file != INVALID_HANDLE_VALUE) CloseHandle(h_file);
+		h_mapping = nullptr;
+		h_file = INVALID_HANDLE_VALUE;
+#else
+		if (data) munmap((void*)data, size);
+		if (fd != -1) ::close(fd);
+		fd = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+};
+
+static inline uint64_t fnv1a_64(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325) {
+	const uint8_t* p = (const uint8_t*)data;
+	for (size_t i = 0; i != size; ++i) {
+		hash ^= p[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+// Identifies a StarCraft install for asset_cache: its path and the contents
+// of .build.info, which names the build of the CASC storage and therefore
+// changes whenever the game is patched.
+static inline uint64_t casc_install_key(const a_string& install_dir) {
+	uint64_t key = fnv1a_64(install_dir.data(), install_dir.size());
+	a_string build_info_filename = install_dir + "/.build.info";
+	FILE* f = fopen(build_info_filename.c_str(), "rb");
+	if (f) {
+		uint8_t buf[0x1000];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), f)) != 0) key = fnv1a_64(buf, n, key);
+		fclose(f);
+	}
+	return key;
+}
+
+// Keeps data files, as returned by a data file loader, in a single
+// memory-mapped cache file. Files found in the cache are copied straight out
+// of the mapping; the loader is only created, and the CASC storage only
+// opened, when a file is missing. Missing files are added to the cache on
+// the next save.
+//
+// The cache is discarded when its format version or its key differ, so the
+// key must change whenever the data files might have (see casc_install_key).
+struct asset_cache {
+	using load_data_file_t = std::function<void(a_vector<uint8_t>&, a_string)>;
+
+	static const uint32_t file_magic = 0x4357424f; // "OBWC"
+	static const uint32_t file_version = 1;
+
+	struct header_t {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint64_t file_size;
+		uint64_t entry_count;
+	};
+	struct entry_t {
+		uint64_t name_offset;
+		uint64_t name_size;
+		uint64_t data_offset;
+		uint64_t data_size;
+	};
+	struct cached_file {
+		const uint8_t* data;
+		size_t size;
+	};
+
+	a_string filename;
+	uint64_t key = 0;
+	std::function<load_data_file_t()> open_loader;
+
+	std::mutex mut;
+	mapped_file file;
+	a_map<a_string, cached_file> files;
+	a_map<a_string, a_vector<uint8_t>> added_files;
+	load_data_file_t loader;
+
+	asset_cache(a_string filename, uint64_t key, std::function<load_data_file_t()> open_loader) : filename(std::move(filename)), key(key), open_loader(std::move(open_loader)) {
+		open();
+	}
+
+	void operator()(a_vector<uint8_t>& dst, a_string name) {
+		std::lock_guard<std::mutex> l(mut);
+		auto i = files.find(name);
+		if (i != files.end()) {
+			dst.assign(i->second.data, i->second.data + i->second.size);
+			return;
+		}
+		auto i2 = added_files.find(name);
+		if (i2 != added_files.end()) {
+			dst = i2->second;
+			return;
+		}
+		if (!loader) loader = open_loader();
+		loader(dst, name);
+		added_files.emplace(std::move(name), dst);
+	}
+
+	// Writes the cache back if files were added since it was opened. Failing
+	// to write the cache is not an error, the files are just loaded again
+	// next time.
+	bool save() {
+		std::lock_guard<std::mutex> l(mut);
+		if (added_files.empty()) return true;
+
+		a_map<a_string, cached_file> all_files = files;
+		for (auto& v : added_files) {
+			all_files[v.first] = {v.second.data(), v.second.size()};
+		}
+
+		auto align = [](uint64_t offset) {
+			return (offset + 15) & ~(uint64_t)15;
+		};
+
+		a_vector<entry_t> entries;
+		uint64_t offset = sizeof(header_t) + sizeof(entry_t) * all_files.size();
+		for (auto& v : all_files) {
+			entry_t e;
+			e.name_offset = offset;
+			e.name_size = v.first.size();
+			offset = align(offset + e.name_size);
+			e.data_offset = offset;
+			e.data_size = v.second.size;
+			offset = align(offset + e.data_size);
+			entries.push_back(e);
+		}
+
+		header_t header;
+		header.magic = file_magic;
+		header.version = file_version;
+		header.key = key;
+		header.file_size = offset;
+		header.entry_count = entries.size();
+
+		a_string tmp_filename = filename + ".tmp";
+		FILE* f = fopen(tmp_filename.c_str(), "wb");
+		if (!f) {
+			warn("asset cache: failed to open '%s' for writing", tmp_filename);
+			return false;
+		}
+		bool ok = true;
+		uint64_t pos = 0;
+		auto write = [&](const void* data, size_t size) {
+			if (ok && size && fwrite(data, size, 1, f) != 1) ok = false;
+			pos += size;
+		};
+		auto pad = [&](uint64_t to) {
+			static const uint8_t zeroes[16] = {};
+			write(zeroes, (size_t)(to - pos));
+		};
+		write(&header, sizeof(header));
+		write(entries.data(), sizeof(entry_t) * entries.size());
+		for (auto& v : all_files) {
+			write(v.first.data(), v.first.size());
+			pad(align(pos));
+			write(v.second.data, v.second.size);
+			pad(align(pos));
+		}
+		if (fclose(f) != 0) ok = false;
+
+		std::error_code ec;
+		if (!ok) {
+			warn("asset cache: failed to write '%s'", tmp_filename);
+			std::filesystem::remove(tmp_filename.c_str(), ec);
+			return false;
+		}
+
+		// The mapping must be closed before the file can be replaced on
+		// Windows; all_files points into it until then.
+		file.close();
+		files.clear();
+		std::filesystem::rename(tmp_filename.c_str(), filename.c_str(), ec);
+		if (ec) {
+			warn("asset cache: failed to replace '%s': %s", filename, ec.message().c_str());
+			std::filesystem::remove(tmp_filename.c_str(), ec);
+		} else {
+			added_files.clear();
+		}
+		open();
+		return !ec;
+	}
+
+private:
+	void open() {
+		files.clear();
+		if (!file.open(filename)) return;
+		auto discard = [&]() {
+			files.clear();
+			file.close();
+		};
+		if (file.size < sizeof(header_t)) return discard();
+		header_t header;
+		memcpy(&header, file.data, sizeof(header));
+		if (header.magic != file_magic || header.version != file_version || header.key != key) return discard();
+		if (header.file_size != file.size) return discard();
+		if (header.entry_count > (file.size - sizeof(header_t)) / sizeof(entry_t)) return discard();
+		for (size_t i = 0; i != header.entry_count; ++i) {
+			entry_t e;
+			memcpy(&e, file.data + sizeof(header_t) + sizeof(entry_t) * i, sizeof(e));
+			if (e.name_offset > file.size || e.name_size > file.size - e.name_offset) return discard();
+			if (e.data_offset > file.size || e.data_size > file.size - e.data_offset) return discard();
+			a_string name((const char*)file.data + e.name_offset, (size_t)e.name_size);
+			files[std::move(name)] = {file.data + e.data_offset, (size_t)e.data_size};
+		}
+	}
+};
+
+// Copyable data file loader for global_state::init and friends, sharing one
+// asset_cache between all copies.
+struct cached_data_files_loader {
+	std::shared_ptr<asset_cache> cache;
+
+	void operator()(a_vector<uint8_t>& dst, a_string filename) {
+		(*cache)(dst, std::move(filename));
+	}
+	bool save() {
+		return cache->save();
+	}
+};
+
+template<typename data_files_loader_T = data_files_loader<>>
+cached_data_files_loader cached_data_files_directory(a_string path, a_string cache_filename) {
+	auto open_loader = [path]() -> asset_cache::load_data_file_t {
+		return data_files_directory<data_files_loader_T>(path);
+	};
+	return {std::make_shared<asset_cache>(std::move(cache_filename), casc_install_key(path), open_loader)};
+}
+
+}
+}
+
+#endif
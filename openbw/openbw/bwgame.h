@@ -7,6 +7,7 @@
 #include "data_loading.h"
 #include "bwenums.h"
 #include "korean.h"
+#include "perf_counters.h"
 
 #include "../bwglobal.h"
 
@@ -203,6 +204,7 @@ struct state_base_copyable {
 	a_vector<tile_t> tiles;
 	a_vector<uint16_t> tiles_mega_tile_index;
 	a_vector<bool> draw_creep_over;
+	creep_bitmap_t creep_bitmap;
 
 	std::array<int, 0x100> random_counts;
 	int total_random_counts;
@@ -301,6 +303,49 @@ struct state_base_non_copyable {
 struct state : state_base_copyable, state_base_non_copyable {
 };
 
+// Reads an iscript program from its pre-decoded form where decode_iscript
+// reached it, and from the raw bytes everywhere else.
+struct iscript_reader {
+	const iscript_t& script;
+	data_loading::data_reader_le raw;
+	const iscript_t::instruction_t* ins = nullptr;
+	const int* operand = nullptr;
+	uint32_t next = iscript_t::no_instruction;
+
+	explicit iscript_reader(const iscript_t& script) : script(script), raw(script.data.data(), script.data.data() + script.data.size()) {}
+
+	void seek(size_t pc) {
+		ins = nullptr;
+		next = pc < script.instruction_at.size() ? script.instruction_at[pc] : iscript_t::no_instruction;
+		if (next == iscript_t::no_instruction) raw.seek(pc);
+	}
+
+	int next_opcode() {
+		if (next != iscript_t::no_instruction) {
+			ins = &script.instructions[next];
+			operand = script.operands.data() + ins->operands_begin;
+			next = ins->next;
+			return ins->opcode;
+		}
+		if (ins) {
+			raw.seek(ins->next_pc);
+			ins = nullptr;
+		}
+		return raw.get<uint8_t>();
+	}
+
+	template<typename T>
+	T get() {
+		if (ins) return (T)*operand++;
+		return raw.get<T>();
+	}
+
+	size_t tell() const {
+		if (ins) return ins->next_pc;
+		return raw.tell();
+	}
+};
+
 struct state_functions {
 
 	virtual void play_sound(int id, xy position, const unit_t* source_unit = nullptr, bool add_race_index = false) {}
@@ -322,6 +367,14 @@ struct state_functions {
 	state_functions(const state_functions& n) : st(n.st) {}
 
 	bool update_tiles = false;
+	bool use_trigger_programs = true;
+	// Also evaluate trigger conditions with the interpreter and error out if the compiled programs disagree.
+	// openbw_batch --verify-triggers sets it.
+	bool verify_trigger_programs = false;
+	// Per trigger timing is only collected while this is set.
+	trigger_profile_t* trigger_profile = nullptr;
+	// Hot path timings are only collected while this is set.
+	perf_counters_t* perf_counters = nullptr;
 	flingy_t* iscript_flingy = nullptr;
 	bullet_t* iscript_bullet = nullptr;
 	unit_t* iscript_unit = nullptr;
@@ -12265,6 +12318,41 @@ struct state_functions {
 		return 0;
 	}
 
+	template<bool check_bounds>
+	void reveal_sight_propagate(const sight_values_t& sight_vals, size_t tile_x, size_t tile_y, int visibility_mask, uint32_t required_tile_mask) {
+		const size_t max_width = 11 * 2 + 3;
+		std::array<uint32_t, max_width * max_width> vision_propagation;
+		tile_t* base_tile = &st.tiles[tile_x + tile_y*game_st.map_tile_width];
+		auto in_bounds = [&](const sight_values_t::maskdat_node_t& cur) {
+			if (!check_bounds) return true;
+			return tile_x + cur.x < game_st.map_tile_width && tile_y + cur.y < game_st.map_tile_height;
+		};
+		size_t index = 0;
+		size_t end = sight_vals.min_mask_size;
+		for (; index != end; ++index) {
+			const auto& cur = sight_vals.maskdat[index];
+			vision_propagation[index] = 0xff;
+			if (!in_bounds(cur)) continue;
+			auto& tile = base_tile[cur.relative_tile_index];
+			tile.visible &= visibility_mask;
+			tile.explored &= visibility_mask;
+			vision_propagation[index] = (uint32_t)tile.flags << 16 | (uint32_t)tile.explored << 8 | (uint32_t)tile.visible;
+		}
+		end += sight_vals.ext_masked_count;
+		for (; index != end; ++index) {
+			const auto& cur = sight_vals.maskdat[index];
+			vision_propagation[index] = 0xff;
+			if (!in_bounds(cur)) continue;
+			if (vision_propagation[cur.prev] & required_tile_mask) {
+				if (cur.prev2 == (size_t)~0 || (vision_propagation[cur.prev2] & required_tile_mask)) continue;
+			}
+			auto& tile = base_tile[cur.relative_tile_index];
+			tile.visible &= visibility_mask;
+			tile.explored &= visibility_mask;
+			vision_propagation[index] = (uint32_t)tile.flags << 16 | (uint32_t)tile.explored << 8 | (uint32_t)tile.visible;
+		}
+	}
+
 	void reveal_sight_at(xy pos, int range, int reveal_to, bool in_air) {
 		int visibility_mask = ~reveal_to;
 		int height_mask = 0;
@@ -12274,51 +12362,33 @@ struct state_functions {
 			else if (height == 1) height_mask = tile_t::flag_very_high | tile_t::flag_high;
 			else height_mask = tile_t::flag_very_high | tile_t::flag_high | tile_t::flag_middle;
 		}
-		const size_t max_width = 11 * 2 + 3;
-		std::array<uint32_t, max_width * max_width> vision_propagation;
 		uint32_t required_tile_mask = (uint32_t)height_mask << 16 | (uint32_t)(uint8_t)~visibility_mask << 8 | (uint32_t)(uint8_t)~visibility_mask;
 		const auto& sight_vals = game_st.sight_values.at(range);
 		size_t tile_x = (size_t)pos.x / 32;
 		size_t tile_y = (size_t)pos.y / 32;
-		tile_t* base_tile = &st.tiles[tile_x + tile_y*game_st.map_tile_width];
 		if (!in_air) {
-			size_t index = 0;
-			size_t end = sight_vals.min_mask_size;
-			for (; index != end; ++index) {
-				const auto& cur = sight_vals.maskdat[index];
-				vision_propagation[index] = 0xff;
-				if (tile_x + cur.x >= game_st.map_tile_width) continue;
-				if (tile_y + cur.y >= game_st.map_tile_height) continue;
-				auto& tile = base_tile[cur.relative_tile_index];
-				tile.visible &= visibility_mask;
-				tile.explored &= visibility_mask;
-				vision_propagation[index] = (uint32_t)tile.flags << 16 | (uint32_t)tile.explored << 8 | (uint32_t)tile.visible;
-			}
-			end += sight_vals.ext_masked_count;
-			for (; index != end; ++index) {
-				const auto& cur = sight_vals.maskdat[index];
-				vision_propagation[index] = 0xff;
-				if (tile_x + cur.x >= game_st.map_tile_width) continue;
-				if (tile_y + cur.y >= game_st.map_tile_height) continue;
-				if (vision_propagation[cur.prev] & required_tile_mask) {
-					if (cur.prev2 == (size_t)~0 || (vision_propagation[cur.prev2] & required_tile_mask)) continue;
-				}
-				auto& tile = base_tile[cur.relative_tile_index];
-				tile.visible &= visibility_mask;
-				tile.explored &= visibility_mask;
-				vision_propagation[index] = (uint32_t)tile.flags << 16 | (uint32_t)tile.explored << 8 | (uint32_t)tile.visible;
-			}
+			// Most units are far enough from the map edge that no node of the mask can fall outside it
+			size_t half_width = sight_vals.max_width / 2;
+			size_t half_height = sight_vals.max_height / 2;
+			bool inside = tile_x >= half_width && tile_x + half_width < game_st.map_tile_width;
+			inside &= tile_y >= half_height && tile_y + half_height < game_st.map_tile_height;
+			if (inside) reveal_sight_propagate<false>(sight_vals, tile_x, tile_y, visibility_mask, required_tile_mask);
+			else reveal_sight_propagate<true>(sight_vals, tile_x, tile_y, visibility_mask, required_tile_mask);
 		} else {
 			// This seems bugged; even for air units, if you only traverse ext_masked_count nodes,
-			// then you will still miss out on the min_mask_size (9) last ones
-			auto* cur = sight_vals.maskdat.data();
-			auto* end = cur + sight_vals.ext_masked_count;
-			for (; cur != end; ++cur) {
-				if (tile_x + cur->x >= game_st.map_tile_width) continue;
-				if (tile_y + cur->y >= game_st.map_tile_height) continue;
-				auto& tile = base_tile[cur->relative_tile_index];
-				tile.visible &= visibility_mask;
-				tile.explored &= visibility_mask;
+			// then you will still miss out on the min_mask_size (9) last ones.
+			// air_spans holds exactly those nodes, so each run is a contiguous clipped row of tiles.
+			uint8_t mask = (uint8_t)visibility_mask;
+			for (auto& span : sight_vals.air_spans) {
+				size_t y = tile_y + span.y;
+				if (y >= game_st.map_tile_height) continue;
+				int from_x = std::max((int)tile_x + span.x_begin, 0);
+				int to_x = std::min((int)tile_x + span.x_end, (int)game_st.map_tile_width);
+				tile_t* row = &st.tiles[y * game_st.map_tile_width];
+				for (int x = from_x; x < to_x; ++x) {
+					row[x].visible &= mask;
+					row[x].explored &= mask;
+				}
 			}
 		}
 	}
@@ -12830,6 +12900,7 @@ struct state_functions {
 	}
 
 	void update_units() {
+		OPENBW_PERF_SCOPE(perf_counters, timer_update_units);
 		--st.order_timer_counter;
 		if (!st.order_timer_counter) {
 			st.order_timer_counter = 150;
@@ -12935,6 +13006,7 @@ struct state_functions {
 	}
 
 	void update_bullets() {
+		OPENBW_PERF_SCOPE(perf_counters, timer_update_bullets);
 
 		for (auto i = st.active_bullets.begin(); i != st.active_bullets.end();) {
 			bullet_t* b = &*i++;
@@ -12970,6 +13042,7 @@ struct state_functions {
 	}
 
 	void update_thingies() {
+		OPENBW_PERF_SCOPE(perf_counters, timer_update_thingies);
 		for (auto i = st.active_thingies.begin(); i != st.active_thingies.end();) {
 			thingy_t* t = &*i++;
 			update_thingy(t);
@@ -13043,6 +13116,7 @@ struct state_functions {
 	}
 
 	void process_frame() {
+		OPENBW_PERF_SCOPE(perf_counters, timer_process_frame);
 		recede_creep();
 
 		if (st.update_tiles_countdown == 0) st.update_tiles_countdown = 100;
@@ -13061,6 +13135,7 @@ struct state_functions {
 	}
 
 	void process_triggers() {
+		OPENBW_PERF_SCOPE(perf_counters, timer_process_triggers);
 		int timer_step = 42;
 
 		for (size_t i = 0; i != 12; ++i) {
@@ -13089,16 +13164,12 @@ struct state_functions {
 			for (auto& rt : st.running_triggers[i]) {
 				if (rt.flags & 8) continue;
 				auto& t = *rt.t;
-				bool execute_now = true;
-				if (~rt.flags & 1) {
-					for (auto& c : t.conditions) {
-						if (c.type == 0) break;
-						if (!test_trigger_condition(c, i)) {
-							execute_now = false;
-							break;
-						}
-					}
+				if (trigger_profile) {
+					if (profile_trigger(ets, i, rt, t)) any_triggers_executed = true;
+					continue;
 				}
+				bool execute_now = true;
+				if (~rt.flags & 1) execute_now = test_trigger_conditions(t, i);
 				if (execute_now) {
 					rt.current_action_index = 0;
 					execute_trigger(ets, i, rt, t);
@@ -13151,6 +13222,39 @@ struct state_functions {
 		process_triggers();
 	}
 
+	// Editor tick: only runs the iscript of units and thingies whose sprite is
+	// inside one of the given areas. Orders, movement, vision and triggers are
+	// not processed and the frame counter does not advance.
+	void next_editor_frame(const a_vector<rect>& areas) {
+		auto in_areas = [&](const sprite_t* sprite) {
+			for (auto& r : areas) {
+				if (sprite->position.x >= r.from.x && sprite->position.x < r.to.x && sprite->position.y >= r.from.y && sprite->position.y < r.to.y) return true;
+			}
+			return false;
+		};
+
+		for (auto i = st.dead_units.begin(); i != st.dead_units.end();) {
+			unit_t* u = &*i++;
+			iscript_flingy = u;
+			iscript_unit = u;
+			update_dead_unit(u);
+		}
+		for (auto i = st.visible_units.begin(); i != st.visible_units.end();) {
+			unit_t* u = &*i++;
+			if (!u->sprite || !in_areas(u->sprite)) continue;
+			iscript_flingy = u;
+			iscript_unit = u;
+			update_unit(u);
+		}
+		iscript_flingy = nullptr;
+		iscript_unit = nullptr;
+
+		for (auto i = st.active_thingies.begin(); i != st.active_thingies.end();) {
+			thingy_t* t = &*i++;
+			if (in_areas(t->sprite)) update_thingy(t);
+		}
+	}
+
 	int lcg_rand(int source) {
 		++st.random_counts[source];
 		++st.total_random_counts;
@@ -14651,8 +14755,7 @@ struct state_functions {
 			if (weapon->bullet_count == 2) fire_weapon(iscript_unit, weapon, forward_offset);
 		};
 
-		auto program_data = data_loading::data_reader_le(global_st.iscript.data.data(), global_st.iscript.data.data() + global_st.iscript.data.size());
-		data_loading::data_reader_le p = program_data;
+		iscript_reader p(global_st.iscript);
 		p.seek(state.program_counter);
 
 		auto playsndrand = [&]() {
@@ -14672,9 +14775,8 @@ struct state_functions {
 
 		while (true) {
 			using namespace iscript_opcodes;
-			size_t pc = p.tell();
 
-			int opc = p.get<uint8_t>();
+			int opc = p.next_opcode();
 			int a, b, c;
 			switch (opc) {
 			case opc_playfram:
@@ -15188,7 +15290,7 @@ struct state_functions {
 
 	void initialize_image(image_t* image, const image_type_t* image_type, sprite_t* sprite, xy offset) {
 		image->image_type = image_type;
-		image->grp = global_st.image_grp[(size_t)image_type->id];
+		image->grp = global_st.get_image_grp((size_t)image_type->id);
 		int flags = 0;
 		if (image_type->has_directional_frames) flags |= image_t::flag_has_directional_frames;
 		if (image_type->is_clickable) flags |= image_t::flag_clickable;
@@ -18895,6 +18997,219 @@ struct state_functions {
 		}
 	}
 
+	void compile_trigger_program(trigger& t) const {
+		auto& prog = t.program;
+		prog.conditions.clear();
+		prog.actions.clear();
+
+		auto resolve_unit_group = [&](int unit_id, trigger_program::unit_group_t& group) {
+			if (unit_id == 229) group = trigger_program::group_any;
+			else if (unit_id == 230) group = trigger_program::group_men;
+			else if (unit_id == 231) group = trigger_program::group_buildings;
+			else if (unit_id == 232) group = trigger_program::group_factories;
+			else if ((size_t)unit_id < (size_t)UnitTypes::None) group = trigger_program::group_unit_type;
+			else return false;
+			return true;
+		};
+
+		for (size_t i = 0; i != 16; ++i) {
+			auto& c = t.conditions[i];
+			if (c.type == 0) break;
+			trigger_program::condition pc{};
+			pc.condition_index = i;
+			pc.player = c.group;
+			pc.count = c.count_n;
+			pc.unit_id = c.unit_id;
+			pc.completed_units = c.num_n != 1;
+			if (c.num_n == 0) pc.cmp = trigger_program::cmp_at_least;
+			else if (c.num_n == 1) pc.cmp = trigger_program::cmp_at_most;
+			else if (c.num_n == 2) pc.cmp = trigger_program::cmp_exactly;
+			else pc.cmp = trigger_program::cmp_never;
+			switch (c.type) {
+			case 2:
+				pc.op = resolve_unit_group(c.unit_id, pc.unit_group) ? trigger_program::op_command : trigger_program::op_interpret;
+				break;
+			case 3:
+				pc.location_index = (size_t)(c.location - 1);
+				if (pc.location_index < st.locations.size() && resolve_unit_group(c.unit_id, pc.unit_group)) pc.op = trigger_program::op_bring;
+				else pc.op = trigger_program::op_interpret;
+				break;
+			case 12:
+				pc.op = trigger_program::op_elapsed_time;
+				break;
+			case 14:
+				pc.op = trigger_program::op_opponents;
+				break;
+			case 23:
+				pc.op = trigger_program::op_never;
+				break;
+			case 1: case 4: case 5: case 6: case 7: case 8: case 9: case 10: case 11: case 13:
+			case 15: case 16: case 17: case 18: case 19: case 20: case 21: case 22:
+				continue;
+			default:
+				pc.op = trigger_program::op_interpret;
+				break;
+			}
+			prog.conditions.push_back(pc);
+		}
+
+		for (size_t i = 0; i != 64; ++i) {
+			auto& a = t.actions[i];
+			if (a.flags & 2) continue;
+			if (a.type == 0) break;
+			switch (a.type) {
+			case 1: case 2: case 3: case 4: case 15: case 22: case 24: case 25: case 26:
+			case 38: case 44: case 46: case 52:
+				prog.actions.push_back((uint8_t)i);
+				break;
+			default:
+				if (a.type < 0 || a.type > 59) prog.actions.push_back((uint8_t)i);
+				break;
+			}
+		}
+		size_t n = 0;
+		for (size_t i = 0; i != 65; ++i) {
+			while (n != prog.actions.size() && prog.actions[n] < i) ++n;
+			prog.resume_action[i] = (uint8_t)n;
+		}
+	}
+
+	uint32_t trigger_player_mask(int owner, int player) const {
+		uint32_t r = 0;
+		for (int n : trigger_players(owner, player)) r |= 1 << n;
+		return r;
+	}
+
+	bool trigger_program_unit_group(const unit_t* u, trigger_program::unit_group_t group, bool count_eggs) const {
+		switch (group) {
+		case trigger_program::group_any:
+			if (u->unit_type->group_flags & (GroupFlags::Men | GroupFlags::Building)) return true;
+			return count_eggs && unit_is_egg(u);
+		case trigger_program::group_men:
+			if (u->unit_type->group_flags & GroupFlags::Men) return true;
+			return count_eggs && (~u->unit_type->group_flags & GroupFlags::Building) && unit_is_egg(u);
+		case trigger_program::group_buildings:
+			return (u->unit_type->group_flags & (GroupFlags::Men | GroupFlags::Building)) == GroupFlags::Building;
+		case trigger_program::group_factories:
+			return (u->unit_type->group_flags & GroupFlags::Factory) != 0;
+		default:
+			return false;
+		}
+	}
+
+	// Mirrors the add_completed recursion in trigger_bring_count, but only counts what the condition asks for.
+	int trigger_program_completed_count(const trigger_program::condition& c, uint32_t players, const unit_t* u) const {
+		int r = 0;
+		bool owned = (players >> u->owner & 1) != 0;
+		bool by_type = c.unit_group == trigger_program::group_unit_type;
+		if (owned && by_type && (int)u->unit_type->id == c.unit_id) ++r;
+		if (unit_provides_space(u)) {
+			for (const unit_t* n : loaded_units(u)) r += trigger_program_completed_count(c, players, n);
+		}
+		if (owned && by_type) {
+			if (unit_is_carrier(u)) {
+				if (c.unit_id == (int)UnitTypes::Protoss_Interceptor) r += u->carrier.inside_count;
+			} else if (unit_is_reaver(u)) {
+				if (c.unit_id == (int)UnitTypes::Protoss_Reaver) r += u->carrier.inside_count;
+			}
+		}
+		if (ut_worker(u) && u->worker.powerup) {
+			if (unit_is(u->worker.powerup, UnitTypes::Powerup_Flag)) r += trigger_program_completed_count(c, players, u->worker.powerup);
+			else if (owned && by_type && (int)u->worker.powerup->unit_type->id == c.unit_id) ++r;
+		}
+		if (owned && by_type && c.unit_id == (int)UnitTypes::Terran_Nuclear_Missile) {
+			if (unit_is(u, UnitTypes::Terran_Nuclear_Silo) && u->building.silo.ready) ++r;
+		}
+		if (owned && !by_type && trigger_program_unit_group(u, c.unit_group, false)) ++r;
+		return r;
+	}
+
+	int trigger_program_bring_count(const trigger_program::condition& c, int owner) const {
+		uint32_t players = trigger_player_mask(owner, c.player);
+		if (!players) return 0;
+		auto& loc = st.locations[c.location_index];
+		int r = 0;
+		for (const unit_t* u : find_units(loc.area)) {
+			if (ut_turret(u)) continue;
+			if (!unit_is_at_elevation_flags(u, loc.elevation_flags)) continue;
+			if (c.completed_units) {
+				// The interpreter reads the owner's count once for every matching player here.
+				if (c.unit_group == trigger_program::group_unit_type) {
+					if (u->owner == owner && (int)u->unit_type->id == c.unit_id) ++r;
+				} else if (players >> u->owner & 1) {
+					if (trigger_program_unit_group(u, c.unit_group, true)) ++r;
+				}
+			} else if (u_completed(u)) {
+				r += trigger_program_completed_count(c, players, u);
+			}
+		}
+		if (c.completed_units && c.unit_group == trigger_program::group_unit_type) {
+			int player_count = 0;
+			for (uint32_t v = players; v; v &= v - 1) ++player_count;
+			r *= player_count;
+		}
+		return r;
+	}
+
+	bool test_trigger_program_condition(const trigger_program::condition& c, const trigger& t, int owner) const {
+		int count;
+		switch (c.op) {
+		case trigger_program::op_command:
+			count = trigger_command_count(st, owner, c.player, c.unit_id, c.completed_units);
+			break;
+		case trigger_program::op_bring:
+			count = trigger_program_bring_count(c, owner);
+			break;
+		case trigger_program::op_elapsed_time:
+			count = st.current_frame;
+			break;
+		case trigger_program::op_opponents:
+			count = trigger_opponent_count(owner, c.player);
+			break;
+		case trigger_program::op_never:
+			return false;
+		default:
+			return test_trigger_condition(t.conditions[c.condition_index], owner);
+		}
+		switch (c.cmp) {
+		case trigger_program::cmp_at_least: return count >= c.count;
+		case trigger_program::cmp_at_most: return count <= c.count;
+		case trigger_program::cmp_exactly: return count == c.count;
+		default: return false;
+		}
+	}
+
+	bool test_trigger_conditions(const trigger& t, int owner) const {
+		if (!use_trigger_programs) {
+			for (auto& c : t.conditions) {
+				if (c.type == 0) break;
+				if (!test_trigger_condition(c, owner)) return false;
+			}
+			return true;
+		}
+		bool r = true;
+		for (auto& c : t.program.conditions) {
+			if (!test_trigger_program_condition(c, t, owner)) {
+				r = false;
+				break;
+			}
+		}
+		if (verify_trigger_programs) {
+			bool interpreted = true;
+			for (auto& c : t.conditions) {
+				if (c.type == 0) break;
+				if (!test_trigger_condition(c, owner)) {
+					interpreted = false;
+					break;
+				}
+			}
+			if (r != interpreted) {
+				error("trigger program mismatch: trigger %d player %d compiled %d interpreted %d", &t - game_st.triggers.data(), owner, r, interpreted);
+			}
+		}
+		return r;
+	}
+
 	unit_t* trigger_create_unit(const unit_type_t* unit_type, xy pos, int owner) {
 		if (~unit_type->staredit_availability_flags & 2) return nullptr;
 		pos = restrict_unit_pos_to_bounds(pos, unit_type, map_bounds());
@@ -19356,14 +19671,41 @@ struct state_functions {
 		return true;
 	}
 
+	bool profile_trigger(execute_trigger_struct& ets, int owner, running_trigger& rt, const trigger& t) {
+		using clock = std::chrono::steady_clock;
+		auto& e = trigger_profile->get(&t - game_st.triggers.data(), owner);
+		++e.evaluations;
+		auto start = clock::now();
+		bool execute_now = true;
+		if (~rt.flags & 1) execute_now = test_trigger_conditions(t, owner);
+		auto conditions_done = clock::now();
+		e.condition_time += conditions_done - start;
+		if (!execute_now) return false;
+		++e.fires;
+		rt.current_action_index = 0;
+		execute_trigger(ets, owner, rt, t);
+		e.action_time += clock::now() - conditions_done;
+		return true;
+	}
+
 	void execute_trigger(execute_trigger_struct& ets, int owner, running_trigger& rt, const trigger& t) {
 		rt.flags |= 1;
 		size_t index = rt.current_action_index;
-		for (;index != 64; ++index) {
-			auto& a = t.actions[index];
-			if (a.flags & 2) continue;
-			if (a.type == 0) index = 63;
-			else if (!execute_trigger_action(ets, owner, rt, rt.actions[index], a)) break;
+		if (use_trigger_programs) {
+			auto& prog = t.program;
+			size_t n = prog.resume_action.at(index);
+			for (; n != prog.actions.size(); ++n) {
+				index = prog.actions[n];
+				if (!execute_trigger_action(ets, owner, rt, rt.actions[index], t.actions[index])) break;
+			}
+			if (n == prog.actions.size()) index = 64;
+		} else {
+			for (;index != 64; ++index) {
+				auto& a = t.actions[index];
+				if (a.flags & 2) continue;
+				if (a.type == 0) index = 63;
+				else if (!execute_trigger_action(ets, owner, rt, rt.actions[index], a)) break;
+			}
 		}
 		rt.current_action_index = index;
 		if (index == 64) {
@@ -19403,42 +19745,14 @@ struct state_functions {
 		return rt;
 	}
 
-	size_t count_neighboring_creep_tiles(xy_t<size_t> tile_pos) {
-		size_t r = 0;
-		size_t width = game_st.map_tile_width;
-		size_t index = tile_pos.y * width + tile_pos.x;
-		index -= width;
-		index -= 1;
-		auto test = [&]() {
-			if (st.tiles[index].flags & tile_t::flag_has_creep) ++r;
-		};
-		if (tile_pos.y != 0) {
-			if (tile_pos.x != 0) test();
-			++index;
-			test();
-			++index;
-			if (tile_pos.x != width - 1) test();
-			index -= 2;
-		}
-		index += width;
-		if (tile_pos.x != 0) test();
-		index += 2;
-		if (tile_pos.x != width - 1) test();
-		index -= 2;
-		index += width;
-		if (tile_pos.y != game_st.map_tile_height - 1) {
-			if (tile_pos.x != 0) test();
-			++index;
-			test();
-			++index;
-			if (tile_pos.x != width - 1) test();
-		}
-		return r;
+	size_t count_neighboring_creep_tiles(xy_t<size_t> tile_pos) const {
+		return st.creep_bitmap.count_neighbors(tile_pos.x, tile_pos.y);
 	}
 
 	void set_tile_creep(xy_t<size_t> tile_pos, bool has_creep = true) {
 		size_t index = tile_pos.y * game_st.map_tile_width + tile_pos.x;
 		st.draw_creep_over[index] = has_creep;
+		st.creep_bitmap.set(tile_pos.x, tile_pos.y, has_creep);
 		if (has_creep) st.tiles[index].flags |= tile_t::flag_has_creep;
 		else st.tiles[index].flags &= ~tile_t::flag_has_creep;
 
@@ -19502,15 +19816,26 @@ struct state_functions {
 		bool any_tiles_occupied = false;
 		for (size_t tile_y = area.from.y; tile_y != area.to.y + 1; ++tile_y, dy += 32) {
 			int dx = (int)area.from.x * 32 - pos.x + 16;
+			size_t near_creep_word_index = ~(size_t)0;
+			uint64_t near_creep_word = 0;
 			for (size_t tile_x = area.from.x; tile_x != area.to.x + 1; ++tile_x, dx += 32) {
 				size_t index = tile_y * game_st.map_tile_width + tile_x;
 				auto flags = st.tiles[index].flags;
 				if (flags & tile_t::flag_has_creep) continue;
+				size_t bit = tile_x + 1;
+				if (bit / 64 != near_creep_word_index) {
+					near_creep_word_index = bit / 64;
+					near_creep_word = st.creep_bitmap.dilated_word(tile_y, near_creep_word_index);
+				}
+				// Tiles with no creep around them can only affect the occupied flag
+				bool near_creep = (near_creep_word >> (bit % 64)) & 1;
+				if (!near_creep && (any_tiles_occupied || !out_any_tiles_occupied)) continue;
 				if (!tile_can_have_creep({tile_x, tile_y})) continue;
 				if (flags & tile_t::flag_occupied) {
 				  if (!any_tiles_occupied) any_tiles_occupied = true;
 				  continue;
 				}
+				if (!near_creep) continue;
 				if (spreads_creep) {
 				  int d = dx * dx * 25 + dy * dy * 64;
 				  if (d > 320 * 320 * 25) continue;
@@ -19820,6 +20145,9 @@ struct game_load_functions : state_functions {
 	game_state& game_st = *st.game;
 
 	bool use_map_settings = false;
+	// Called once the terrain is loaded, before the regions are created, so
+	// that callers can report region creation as a stage of its own.
+	std::function<void()> regions_create_started;
 
 	struct setup_info_t {
 		std::array<bool, 12> create_melee_units_for_player{};
@@ -19993,6 +20321,7 @@ struct game_load_functions : state_functions {
 		st.tiles_mega_tile_index.resize(st.tiles.size());
 		st.draw_creep_over.clear();
 		st.draw_creep_over.resize(st.tiles.size());
+		st.creep_bitmap.reset(game_st.map_tile_width, game_st.map_tile_height);
 
 		st.update_tiles_countdown = 1;
 
@@ -20089,6 +20418,7 @@ struct game_load_functions : state_functions {
 	}
 
 	void regions_create() {
+		OPENBW_PERF_SCOPE(perf_counters, timer_regions_create);
 
 		a_vector<uint8_t> unwalkable_flags(256 * 4 * 256 * 4);
 
@@ -21129,6 +21459,24 @@ struct game_load_functions : state_functions {
 				if (i < v.max_height - 1) --cur_y;
 			}
 
+			a_vector<bool> air_mask(v.max_width * v.max_height);
+			for (int i = 0; i != v.ext_masked_count; ++i) {
+				auto& n = v.maskdat[i];
+				air_mask.at((n.y + v.max_height / 2) * v.max_width + n.x + v.max_width / 2) = true;
+			}
+			v.air_spans.clear();
+			for (int y = 0; y != v.max_height; ++y) {
+				for (int x = 0; x != v.max_width;) {
+					if (!air_mask[y * v.max_width + x]) {
+						++x;
+						continue;
+					}
+					int begin = x;
+					while (x != v.max_width && air_mask[y * v.max_width + x]) ++x;
+					v.air_spans.push_back({y - v.max_height / 2, begin - v.max_width / 2, x - v.max_width / 2});
+				}
+			}
+
 		}
 
 	}
@@ -21395,6 +21743,14 @@ struct game_load_functions : state_functions {
 			tiles_flags_and(0, game_st.map_tile_height - 1, game_st.map_tile_width, 1, ~(tile_t::flag_walkable | tile_t::flag_has_creep | tile_t::flag_partially_walkable));
 			tiles_flags_or(0, game_st.map_tile_height - 1, game_st.map_tile_width, 1, tile_t::flag_unbuildable);
 
+			st.creep_bitmap.reset(game_st.map_tile_width, game_st.map_tile_height);
+			for (size_t y = 0; y != game_st.map_tile_height; ++y) {
+				for (size_t x = 0; x != game_st.map_tile_width; ++x) {
+					if (st.tiles[y * game_st.map_tile_width + x].flags & tile_t::flag_has_creep) st.creep_bitmap.set(x, y, true);
+				}
+			}
+
+			if (regions_create_started) regions_create_started();
 			regions_create();
 		};
 
@@ -21777,6 +22133,7 @@ struct game_load_functions : state_functions {
 				if (!enabled_for_any) game_st.triggers.pop_back();
 			}
 			for (auto& t : game_st.triggers) {
+				compile_trigger_program(t);
 				for (int i = 0; i != 8; ++i) {
 					if (st.players[i].controller != player_t::controller_occupied) continue;
 					if (!t.enabled[i] && !t.enabled.at(17 + st.players[i].force) && !t.enabled[17]) continue;
@@ -21949,9 +22306,17 @@ struct game_load_functions : state_functions {
 // TODO: Remove (merge with replay, remove for normal game)
 struct game_player {
 private:
-	std::unique_ptr<game_state> uptr_game_st = std::make_unique<game_state>();
-	std::unique_ptr<state> uptr_st = std::make_unique<state>();
+	// Declared first so that it outlives the states allocated from it.
+	std::unique_ptr<memory_arena> uptr_arena = std::make_unique<memory_arena>();
+	std::unique_ptr<game_state> uptr_game_st = make_in_arena<game_state>();
+	std::unique_ptr<state> uptr_st = make_in_arena<state>();
 	std::optional<state_functions> opt_funcs;
+
+	template<typename T>
+	std::unique_ptr<T> make_in_arena() {
+		arena_scope scope(uptr_arena.get());
+		return std::make_unique<T>();
+	}
 public:
 	game_player() {
 	  state& st = *uptr_st;
@@ -21983,6 +22348,11 @@ public:
 	state& st() const {
 		return funcs().st;
 	}
+	// The arena of the states created by this player. Only used for
+	// allocation when OPENBW_ARENA_ALLOCATOR is defined.
+	memory_arena* arena() const {
+		return uptr_arena.get();
+	}
 };
 
 }
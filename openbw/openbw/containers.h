@@ -15,11 +15,20 @@
 #include "static_vector.h"
 #include "intrusive_list.h"
 #include "circular_vector.h"
+#include "arena.h"
 
 namespace bwgame {
 
+// All containers below allocate through alloc. Defining OPENBW_ARENA_ALLOCATOR
+// makes them allocate from the memory_arena of the state they belong to (see
+// arena.h and game_player) instead of directly from the heap.
+#ifdef OPENBW_ARENA_ALLOCATOR
+template<typename T>
+using alloc = arena_allocator<T>;
+#else
 template<typename T>
 using alloc = std::allocator<T>;
+#endif
 
 template<typename T>
 using a_vector = std::vector<T, alloc<T>>;
@@ -496,10 +496,19 @@ void decompress(uint8_t* input, size_t input_size, uint8_t* output, size_t outpu
 struct mpq_file {
 	MpqFile mpq{ false, false };
 	explicit mpq_file(a_string filename) {
-	  mpq.open(filename);
+	  mpq.open(std::string(filename.begin(), filename.end()));
 	}
-	void operator()(a_vector<uint8_t>& dst, a_string filename) {
-	  mpq.getFile(filename, dst);
+	// MpqFile takes std types, which a_string and a_vector are not when
+	// OPENBW_ARENA_ALLOCATOR is defined.
+	template<typename vector_T>
+	void operator()(vector_T& dst, a_string filename) {
+	  if constexpr (std::is_same_v<vector_T, std::vector<uint8_t>>) {
+		mpq.getFile(std::string(filename.begin(), filename.end()), dst);
+	  } else {
+		std::vector<uint8_t> data;
+		mpq.getFile(std::string(filename.begin(), filename.end()), data);
+		dst.assign(data.begin(), data.end());
+	  }
 	}
 };
 
@@ -481,18 +481,51 @@ namespace iscript_anims {
 struct iscript_t {
   a_vector<uint8_t> data;
   a_map<int, std::array<uint16_t, iscript_anims::MAX>> script_anim_offsets;
+
+  // The reachable part of data, decoded once at load time by decode_iscript so
+  // that executing a script does not re-parse and bounds check every operand.
+  struct instruction_t {
+	int opcode;
+	uint32_t operands_begin;
+	uint32_t next_pc;
+	uint32_t next;
+  };
+  static constexpr uint32_t no_instruction = ~(uint32_t)0;
+  a_vector<instruction_t> instructions;
+  a_vector<int> operands;
+  // Instruction index by byte offset into data, or no_instruction.
+  a_vector<uint32_t> instruction_at;
 };
 
 struct grp_t {
 	struct frame_t {
 		xy_t<size_t> offset;
 		xy_t<size_t> size;
-		a_vector<size_t> line_data_offset;
-		a_vector<uint8_t> data_container;
+		// Both point into the arenas of the grp_t that owns the frame. There
+		// are size.y line offsets, relative to data.
+		const uint32_t* line_data_offset = nullptr;
+		const uint8_t* data = nullptr;
+
+		const uint8_t* line_data(size_t y) const {
+			if (y >= size.y) error("grp line %d out of range (frame height %d)", y, size.y);
+			return data + line_data_offset[y];
+		}
 	};
-	size_t width;
-	size_t height;
+	size_t width = 0;
+	size_t height = 0;
 	a_vector<frame_t> frames;
+	// The line offsets and RLE data of all frames, stored contiguously so a
+	// grp is three allocations regardless of its frame count.
+	a_vector<uint32_t> line_data_offsets;
+	a_vector<uint8_t> line_data;
+
+	grp_t() = default;
+	// Frames point into the arenas, which moving keeps in place but copying
+	// would not.
+	grp_t(const grp_t&) = delete;
+	grp_t& operator=(const grp_t&) = delete;
+	grp_t(grp_t&&) = default;
+	grp_t& operator=(grp_t&&) = default;
 };
 
 }
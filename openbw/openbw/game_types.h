@@ -5,6 +5,9 @@
 #include "data_types.h"
 #include "containers.h"
 
+#include <bit>
+#include <chrono>
+
 namespace bwgame {
 
 struct sprite_t;
@@ -150,6 +153,56 @@ struct sight_values_t {
 	int min_mask_size;
 	int ext_masked_count;
 	a_vector<maskdat_node_t> maskdat;
+	// The tiles revealed to air units (the first ext_masked_count nodes of maskdat),
+	// merged into horizontal runs so they can be applied a row at a time.
+	struct span_t {
+		int y;
+		int x_begin;
+		int x_end;
+	};
+	a_vector<span_t> air_spans;
+};
+
+// A trigger compiled at load time. Conditions that always pass are dropped and
+// the remaining ones carry their operands already decoded; actions are reduced
+// to the indices that actually do something.
+struct trigger_program {
+	enum condition_op : uint8_t {
+		op_interpret, // evaluate the original condition
+		op_command,
+		op_bring,
+		op_elapsed_time,
+		op_opponents,
+		op_never
+	};
+	enum comparison_t : uint8_t {
+		cmp_at_least,
+		cmp_at_most,
+		cmp_exactly,
+		cmp_never
+	};
+	enum unit_group_t : uint8_t {
+		group_unit_type,
+		group_any,
+		group_men,
+		group_buildings,
+		group_factories
+	};
+	struct condition {
+		condition_op op;
+		comparison_t cmp;
+		unit_group_t unit_group;
+		bool completed_units;
+		int player;
+		int count;
+		int unit_id;
+		size_t location_index;
+		size_t condition_index;
+	};
+	static_vector<condition, 16> conditions;
+	static_vector<uint8_t, 64> actions;
+	// first entry in actions whose index is >= the running trigger's current_action_index
+	std::array<uint8_t, 65> resume_action;
 };
 
 struct trigger {
@@ -181,6 +234,7 @@ struct trigger {
 	std::array<action, 64> actions;
 	int execution_flags;
 	std::array<bool, 28> enabled;
+	trigger_program program;
 };
 
 struct running_trigger {
@@ -193,6 +247,25 @@ struct running_trigger {
 	size_t current_action_index = 0;
 };
 
+struct trigger_profile_t {
+	struct entry {
+		uint64_t evaluations = 0;
+		uint64_t fires = 0;
+		std::chrono::nanoseconds condition_time{};
+		std::chrono::nanoseconds action_time{};
+	};
+	// Indexed by trigger index in game_state::triggers, then by the player running it.
+	a_vector<std::array<entry, 8>> triggers;
+
+	entry& get(size_t trigger_index, int owner) {
+		if (trigger_index >= triggers.size()) triggers.resize(trigger_index + 1);
+		return triggers[trigger_index][owner];
+	}
+	void clear() {
+		triggers.clear();
+	}
+};
+
 struct location {
 	rect area;
 	int elevation_flags;
@@ -379,6 +452,63 @@ struct creep_life_t {
 	}
 };
 
+// One bit per tile mirroring tile_t::flag_has_creep, so that neighbour counts and
+// spread candidates can be computed a row word at a time. Tile x is stored at bit
+// x + 1 of its row, leaving a zero bit on either side of the map.
+struct creep_bitmap_t {
+	size_t width = 0;
+	size_t height = 0;
+	size_t words_per_row = 0;
+	a_vector<uint64_t> bits;
+
+	void reset(size_t width, size_t height) {
+		this->width = width;
+		this->height = height;
+		words_per_row = (width + 2 + 63) / 64;
+		bits.assign(words_per_row * height, 0);
+	}
+	const uint64_t* row(size_t y) const {
+		return &bits[y * words_per_row];
+	}
+	bool get(size_t x, size_t y) const {
+		size_t p = x + 1;
+		return (row(y)[p / 64] >> (p % 64)) & 1;
+	}
+	void set(size_t x, size_t y, bool value) {
+		size_t p = x + 1;
+		uint64_t& w = bits[y * words_per_row + p / 64];
+		if (value) w |= (uint64_t)1 << (p % 64);
+		else w &= ~((uint64_t)1 << (p % 64));
+	}
+	// Bits for tiles x - 1, x and x + 1 in the low three bits.
+	uint64_t get3(size_t x, size_t y) const {
+		if (y >= height) return 0;
+		const uint64_t* r = row(y);
+		size_t p = x;
+		uint64_t w = r[p / 64] >> (p % 64);
+		if (p % 64 > 61) w |= r[p / 64 + 1] << (64 - p % 64);
+		return w & 7;
+	}
+	size_t count_neighbors(size_t x, size_t y) const {
+		return std::popcount(get3(x, y - 1)) + std::popcount(get3(x, y) & 5) + std::popcount(get3(x, y + 1));
+	}
+	// The word of padded row y starting at bit word_index * 64 with the creep map dilated
+	// by one tile in every direction. A set bit marks a tile with creep on it or next to it.
+	uint64_t dilated_word(size_t y, size_t word_index) const {
+		auto column = [&](size_t i) {
+			if (i >= words_per_row) return (uint64_t)0;
+			uint64_t r = row(y)[i];
+			if (y != 0) r |= row(y - 1)[i];
+			if (y + 1 < height) r |= row(y + 1)[i];
+			return r;
+		};
+		uint64_t prev = word_index ? column(word_index - 1) : 0;
+		uint64_t cur = column(word_index);
+		uint64_t next = column(word_index + 1);
+		return cur | cur << 1 | prev >> 63 | cur >> 1 | next << 63;
+	}
+};
+
 struct target_t {
 	xy pos;
 	unit_t* unit = nullptr;
@@ -0,0 +1,110 @@
+#ifndef BWGAME_PERF_COUNTERS_H
+#define BWGAME_PERF_COUNTERS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// Scoped timers and counters for the simulation and drawing hot paths.
+// Nothing is collected unless a perf_counters_t is attached to the functions
+// object doing the work; defining OPENBW_NO_PERF_COUNTERS removes the
+// instrumentation from the build entirely.
+
+namespace bwgame {
+
+struct perf_counters_t {
+	enum timer_id {
+		timer_process_frame,
+		timer_update_units,
+		timer_update_bullets,
+		timer_update_thingies,
+		timer_process_triggers,
+		timer_draw_tiles,
+		timer_draw_sprites,
+		timer_draw_minimap,
+		timer_load_map,
+		timer_regions_create,
+		timer_count
+	};
+	enum counter_id {
+		counter_sprites_drawn,
+		counter_count
+	};
+
+	struct timer {
+		uint64_t calls = 0;
+		std::chrono::nanoseconds total{};
+		std::chrono::nanoseconds last{};
+		std::chrono::nanoseconds max{};
+		// Exponential moving average over roughly the last 16 calls.
+		std::chrono::nanoseconds average{};
+
+		void add(std::chrono::nanoseconds time) {
+			if (calls == 0) average = time;
+			else average += (time - average) / 16;
+			++calls;
+			total += time;
+			last = time;
+			if (time > max) max = time;
+		}
+	};
+	struct counter {
+		uint64_t total = 0;
+		uint64_t last = 0;
+	};
+
+	std::array<timer, timer_count> timers;
+	std::array<counter, counter_count> counters;
+
+	static const char* timer_name(size_t index) {
+		static const std::array<const char*, timer_count> names = {
+			"process_frame", "update_units", "update_bullets", "update_thingies", "process_triggers",
+			"draw_tiles", "draw_sprites", "draw_minimap", "load_map", "regions_create"
+		};
+		return names.at(index);
+	}
+	static const char* counter_name(size_t index) {
+		static const std::array<const char*, counter_count> names = {
+			"sprites_drawn"
+		};
+		return names.at(index);
+	}
+
+	void count(counter_id id, uint64_t n) {
+		counters[id].total += n;
+		counters[id].last = n;
+	}
+
+	void clear() {
+		timers = {};
+		counters = {};
+	}
+};
+
+struct perf_scope {
+	using clock = std::chrono::steady_clock;
+	perf_counters_t* counters;
+	perf_counters_t::timer_id id;
+	clock::time_point start;
+
+	perf_scope(perf_counters_t* counters, perf_counters_t::timer_id id) : counters(counters), id(id) {
+		if (counters) start = clock::now();
+	}
+	perf_scope(const perf_scope&) = delete;
+	perf_scope& operator=(const perf_scope&) = delete;
+	~perf_scope() {
+		if (counters) counters->timers[id].add(clock::now() - start);
+	}
+};
+
+}
+
+#ifdef OPENBW_NO_PERF_COUNTERS
+#define OPENBW_PERF_SCOPE(counters, id)
+#define OPENBW_PERF_COUNT(counters, id, n)
+#else
+#define OPENBW_PERF_SCOPE(counters, id) ::bwgame::perf_scope perf_scope_##id(counters, ::bwgame::perf_counters_t::id)
+#define OPENBW_PERF_COUNT(counters, id, n) do { if (counters) (counters)->count(::bwgame::perf_counters_t::id, n); } while (false)
+#endif
+
+#endif
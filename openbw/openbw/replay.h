@@ -208,7 +208,7 @@ struct replay_functions: action_functions {
 		map_buffer.resize(r.template get<uint32_t>());
 		r.get_bytes(map_buffer.data(), map_buffer.size());
 
-		if (get_map_data) *get_map_data = map_buffer;
+		if (get_map_data) get_map_data->assign(map_buffer.begin(), map_buffer.end());
 		
 		game_load_functions game_load_funcs(st);
 		game_load_funcs.load_map_data(map_buffer.data(), map_buffer.size(), [&]() {
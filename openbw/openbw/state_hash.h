@@ -0,0 +1,310 @@
+#ifndef BWGAME_STATE_HASH_H
+#define BWGAME_STATE_HASH_H
+
+#include "bwgame.h"
+
+#include <cstdio>
+
+namespace bwgame {
+
+// Deterministic hash of a game state, split by subsystem so that two runs that
+// diverge can be told apart by what diverged first. Only simulation data is
+// hashed; pointers are replaced by the index of the object they refer to.
+struct state_hash_t {
+	enum subsystem_t {
+		subsystem_counters,
+		subsystem_rng,
+		subsystem_units,
+		subsystem_sprites,
+		subsystem_bullets,
+		subsystem_tiles,
+		subsystem_count
+	};
+	int frame = 0;
+	std::array<uint32_t, subsystem_count> values{};
+
+	static const char* subsystem_name(size_t index) {
+		static const std::array<const char*, subsystem_count> names = {
+			"counters", "rng", "units", "sprites", "bullets", "tiles"
+		};
+		return names.at(index);
+	}
+
+	uint32_t combined() const {
+		uint32_t hash = 2166136261u;
+		for (auto v : values) {
+			hash ^= v;
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	bool operator==(const state_hash_t& n) const {
+		return frame == n.frame && values == n.values;
+	}
+	bool operator!=(const state_hash_t& n) const {
+		return !(*this == n);
+	}
+};
+
+// Hashes the whole state each time rather than keeping running hashes updated
+// as the state changes. Keeping them up to date would mean a hook at every
+// write to a hashed field in bwgame.h. A missed hook would go unnoticed, and
+// this is the tool meant to catch such mistakes. A full hash takes about
+// 100us for the tiles of a 256x256 map plus about 75ns per unit and its
+// sprite, so sample every few frames rather than every frame on big maps.
+struct state_hasher {
+	struct fnv1a {
+		uint32_t hash = 2166136261u;
+		void add(uint32_t v) {
+			hash ^= v;
+			hash *= 16777619u;
+		}
+		template<typename T>
+		void add_raw(T v) {
+			add((uint32_t)v.raw_value);
+		}
+		void add(xy pos) {
+			add((uint32_t)pos.x);
+			add((uint32_t)pos.y);
+		}
+		void add(xy_fp8 pos) {
+			add_raw(pos.x);
+			add_raw(pos.y);
+		}
+	};
+
+	template<typename T>
+	static uint32_t ref(const T* ptr) {
+		return ptr ? (uint32_t)ptr->index + 1 : 0;
+	}
+
+	static void hash_counters(fnv1a& h, const state& st) {
+		h.add(st.current_frame);
+		h.add(st.update_tiles_countdown);
+		h.add(st.order_timer_counter);
+		h.add(st.secondary_order_timer_counter);
+		h.add((uint32_t)st.active_orders_size);
+		h.add((uint32_t)st.active_bullets_size);
+		h.add((uint32_t)st.active_thingies_size);
+		h.add(st.trigger_timer);
+		for (size_t i = 0; i != 12; ++i) {
+			h.add(st.current_minerals[i]);
+			h.add(st.current_gas[i]);
+			h.add(st.total_minerals_gathered[i]);
+			h.add(st.total_gas_gathered[i]);
+			h.add(st.unit_score[i]);
+			h.add(st.building_score[i]);
+			for (size_t race = 0; race != 3; ++race) {
+				h.add_raw(st.supply_used[i][race]);
+				h.add_raw(st.supply_available[i][race]);
+			}
+			for (auto v : st.unit_counts[i]) h.add(v);
+			for (auto v : st.completed_unit_counts[i]) h.add(v);
+		}
+	}
+
+	static void hash_rng(fnv1a& h, const state& st) {
+		h.add(st.lcg_rand_state);
+		h.add(st.total_random_counts);
+		for (auto v : st.random_counts) h.add(v);
+	}
+
+	static void hash_unit(fnv1a& h, const unit_t* u) {
+		h.add((uint32_t)u->index);
+		h.add((uint32_t)u->unit_type->id);
+		h.add(u->owner);
+		h.add(u->status_flags);
+		h.add((uint32_t)u->order_type->id);
+		h.add(u->order_state);
+		h.add(u->main_order_timer);
+		h.add(u->order_target.pos);
+		h.add(ref(u->order_target.unit));
+		h.add(u->ground_weapon_cooldown);
+		h.add(u->air_weapon_cooldown);
+		h.add(u->spell_cooldown);
+		h.add_raw(u->hp);
+		h.add_raw(u->shield_points);
+		h.add_raw(u->energy);
+		h.add(u->exact_position);
+		h.add(u->velocity);
+		h.add_raw(u->heading);
+		h.add_raw(u->current_speed);
+		h.add(u->movement_flags);
+		h.add(u->move_target.pos);
+		h.add(ref(u->sprite));
+		h.add(ref(u->subunit));
+		h.add(u->order_queue_count);
+		h.add((uint32_t)u->build_queue.size());
+		h.add(u->remaining_build_time);
+		h.add(u->kill_count);
+	}
+
+	static void hash_units(fnv1a& h, const state& st) {
+		for (const unit_t* u : ptr(st.visible_units)) hash_unit(h, u);
+		h.add(0xffffffffu);
+		for (const unit_t* u : ptr(st.hidden_units)) hash_unit(h, u);
+		h.add(0xffffffffu);
+		for (const unit_t* u : ptr(st.map_revealer_units)) hash_unit(h, u);
+	}
+
+	static void hash_sprites(fnv1a& h, const state& st) {
+		for (auto& line : st.sprites_on_tile_line) {
+			for (const sprite_t* s : ptr(line)) {
+				h.add((uint32_t)s->index);
+				h.add((uint32_t)s->sprite_type->id);
+				h.add(s->owner);
+				h.add(s->flags);
+				h.add(s->visibility_flags);
+				h.add(s->elevation_level);
+				h.add(s->position);
+				for (const image_t* i : ptr(s->images)) {
+					h.add((uint32_t)i->image_type->id);
+					h.add(i->flags);
+					h.add((uint32_t)i->frame_index);
+					h.add(i->offset);
+					h.add((uint32_t)i->iscript_state.program_counter);
+					h.add(i->iscript_state.animation);
+					h.add(i->iscript_state.wait);
+				}
+			}
+			h.add(0xffffffffu);
+		}
+	}
+
+	static void hash_bullets(fnv1a& h, const state& st) {
+		for (const bullet_t* b : ptr(st.active_bullets)) {
+			h.add((uint32_t)b->index);
+			h.add((uint32_t)b->weapon_type->id);
+			h.add(b->bullet_state);
+			h.add(b->owner);
+			h.add(b->exact_position);
+			h.add(b->velocity);
+			h.add(b->remaining_time);
+			h.add(b->remaining_bounces);
+			h.add(b->bullet_target_pos);
+			h.add(ref(b->bullet_target));
+			h.add(ref(b->bullet_owner_unit));
+		}
+	}
+
+	static void hash_tiles(fnv1a& h, const state& st) {
+		for (auto& v : st.tiles) {
+			h.add((uint32_t)v.visible | (uint32_t)v.explored << 8 | (uint32_t)v.flags << 16);
+		}
+	}
+
+	static state_hash_t hash(const state& st) {
+		state_hash_t r;
+		r.frame = st.current_frame;
+		auto run = [&](state_hash_t::subsystem_t subsystem, void (*f)(fnv1a&, const state&)) {
+			fnv1a h;
+			f(h, st);
+			r.values[subsystem] = h.hash;
+		};
+		run(state_hash_t::subsystem_counters, hash_counters);
+		run(state_hash_t::subsystem_rng, hash_rng);
+		run(state_hash_t::subsystem_units, hash_units);
+		run(state_hash_t::subsystem_sprites, hash_sprites);
+		run(state_hash_t::subsystem_bullets, hash_bullets);
+		run(state_hash_t::subsystem_tiles, hash_tiles);
+		return r;
+	}
+};
+
+// Writes one line per sampled frame: the frame number followed by the hash of
+// each subsystem in hex. Two streams can be compared with diff_state_hash_streams.
+struct state_hash_stream_writer {
+	FILE* f = nullptr;
+	int interval = 1;
+
+	state_hash_stream_writer() = default;
+	state_hash_stream_writer(const state_hash_stream_writer&) = delete;
+	state_hash_stream_writer& operator=(const state_hash_stream_writer&) = delete;
+	~state_hash_stream_writer() {
+		if (f) fclose(f);
+	}
+
+	void open(const a_string& filename, int interval) {
+		if (f) fclose(f);
+		f = fopen(filename.c_str(), "w");
+		if (!f) error("state_hash_stream_writer: failed to open %s for writing", filename);
+		this->interval = interval > 0 ? interval : 1;
+	}
+
+	void write(const state_hash_t& h) {
+		fprintf(f, "%d", h.frame);
+		for (auto v : h.values) fprintf(f, " %08x", v);
+		fprintf(f, "\n");
+	}
+
+	// Call once per frame; samples every interval frames.
+	void update(const state& st) {
+		if (!f || st.current_frame % interval) return;
+		write(state_hasher::hash(st));
+	}
+};
+
+inline a_vector<state_hash_t> read_state_hash_stream(const a_string& filename) {
+	FILE* f = fopen(filename.c_str(), "r");
+	if (!f) error("read_state_hash_stream: failed to open %s for reading", filename);
+	a_vector<state_hash_t> r;
+	while (true) {
+		state_hash_t h;
+		if (fscanf(f, "%d", &h.frame) != 1) break;
+		for (auto& v : h.values) {
+			unsigned int n = 0;
+			if (fscanf(f, "%x", &n) != 1) {
+				fclose(f);
+				error("read_state_hash_stream: %s: truncated entry for frame %d", filename, h.frame);
+			}
+			v = n;
+		}
+		r.push_back(h);
+	}
+	fclose(f);
+	return r;
+}
+
+struct state_hash_divergence {
+	bool diverged = false;
+	int frame = 0;
+	// Bit n is set if subsystem n differs; 0 if one stream simply ended first.
+	uint32_t subsystems = 0;
+	a_string message;
+};
+
+inline state_hash_divergence diff_state_hash_streams(const a_vector<state_hash_t>& a, const a_vector<state_hash_t>& b) {
+	state_hash_divergence r;
+	size_t n = std::min(a.size(), b.size());
+	for (size_t i = 0; i != n; ++i) {
+		if (a[i] == b[i]) continue;
+		r.diverged = true;
+		r.frame = std::min(a[i].frame, b[i].frame);
+		if (a[i].frame != b[i].frame) {
+			r.message = format("sampled frames differ: %d vs %d", a[i].frame, b[i].frame);
+			return r;
+		}
+		a_string names;
+		for (size_t s = 0; s != state_hash_t::subsystem_count; ++s) {
+			if (a[i].values[s] == b[i].values[s]) continue;
+			r.subsystems |= 1u << s;
+			if (!names.empty()) names += ", ";
+			names += state_hash_t::subsystem_name(s);
+		}
+		r.message = format("first divergence at frame %d in %s", r.frame, names);
+		return r;
+	}
+	if (a.size() != b.size()) {
+		r.diverged = true;
+		r.frame = n ? a[n - 1].frame : 0;
+		r.message = format("streams agree for %d samples, then one ends (%d vs %d samples)", n, a.size(), b.size());
+		return r;
+	}
+	r.message = format("streams match (%d samples)", n);
+	return r;
+}
+
+}
+
+#endif
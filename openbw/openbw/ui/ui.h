@@ -51,7 +51,7 @@ struct ui_util_functions: replay_functions {
 		if ((size_t)x >= frame.size.x) return false;
 		if ((size_t)y >= frame.size.y) return false;
 
-		const uint8_t* d = frame.data_container.data() + frame.line_data_offset.at(y);
+		const uint8_t* d = frame.line_data(y);
 		while (x > 0) {
 			int v = *d++;
 			if (v & 0x80) {
@@ -139,6 +139,7 @@ struct ui_functions: ui_util_functions {
 	  if (global_ui_st.global_volume == 0) return;
 	  if (add_race_index) id += 1;
 	  if ((size_t)id >= global_ui_st.has_loaded_sound.size()) return;
+	  std::lock_guard<std::mutex> l(global_ui_st.sound_mutex);
 	  if (!global_ui_st.has_loaded_sound[id]) {
 		global_ui_st.has_loaded_sound[id] = true;
 		a_vector<uint8_t> data;
@@ -233,9 +234,12 @@ struct ui_functions: ui_util_functions {
 		return {{from_tile_x, from_tile_y}, {to_tile_x, to_tile_y}};
 	}
 
-	tileset_image_data tileset_img;
+	// Shared with every other map using the same tileset, and never modified.
+	// The per-map palette is kept separately in palette_colors.
+	const tileset_image_data* tileset_img = nullptr;
 
 	void draw_tiles(uint8_t* data, size_t data_pitch, rect screen_rect) {
+		OPENBW_PERF_SCOPE(perf_counters, timer_draw_tiles);
 
 		auto screen_tile = screen_tile_bounds(screen_rect);
 
@@ -274,7 +278,7 @@ struct ui_functions: ui_util_functions {
 				if (draw_creep_here) {
 				  index = cv5().at(1).mega_tile_index[global_ui_st.creep_random_tile_indices[tile_x + tile_y * game_st.map_tile_width]];
 				}
-				draw_tile(tileset_img, index, dst, data_pitch, offset_x, offset_y, width, height);
+				draw_tile(*tileset_img, index, dst, data_pitch, offset_x, offset_y, width, height);
 
 				// Draw creep edges
 				if (!draw_creep_here) {
@@ -290,7 +294,7 @@ struct ui_functions: ui_util_functions {
 
 				  if (creep_frame) {
 
-					auto& frame = tileset_img.creep_grp.frames.at(creep_frame - 1);
+					auto& frame = tileset_img->creep_grp.frames.at(creep_frame - 1);
 
 					screen_x += frame.offset.x;
 					screen_y += frame.offset.y;
@@ -364,8 +368,8 @@ struct ui_functions: ui_util_functions {
 		height = std::min(height, screen_rect.height() - screen_y);
 
 		auto draw_alpha = [&](size_t index, auto remap_f) {
-			auto& data = tileset_img.light_pcx.at(index).data;
-			uint8_t* ptr = data.data();
+			auto& data = tileset_img->light_pcx.at(index).data;
+			const uint8_t* ptr = data.data();
 			size_t size = data.size() / 256;
 			auto glow = [ptr, size, remap_f](uint8_t new_value, uint8_t old_value) {
 				new_value = remap_f(new_value, old_value);
@@ -391,7 +395,7 @@ struct ui_functions: ui_util_functions {
 				if (new_value >= 8 && new_value < 16) return color_ptr[new_value - 8];
 				return new_value;
 			});
-			uint8_t* selector = tileset_img.cloak_fade_selector.data();
+			const uint8_t* selector = tileset_img->cloak_fade_selector.data();
 			int value = image->modifier_data1;
 			auto cloaking = [color_ptr, selector, value](uint8_t new_value, uint8_t old_value) {
 				if (selector[new_value] <= value) return old_value;
@@ -417,19 +421,19 @@ struct ui_functions: ui_util_functions {
 		else if (image->modifier == 9) {
 		  draw_alpha(image->image_type->color_shift - 1, no_remap());
 		} else if (image->modifier == 10) {
-			uint8_t* ptr = &tileset_img.dark_pcx.data[256 * 18];
+			const uint8_t* ptr = &tileset_img->dark_pcx.data[256 * 18];
 			auto shadow = [ptr](uint8_t, uint8_t old_value) {
 				return ptr[old_value];
 			};
 			draw_frame(frame, i_flag(image, image_t::flag_horizontally_flipped), dst, data_pitch, offset_x, offset_y, width, height, shadow);
 		} else if (image->modifier == 12) {
 			if (temporary_warp_texture_buffer.size() < frame.size.x * frame.size.y) temporary_warp_texture_buffer.resize(frame.size.x * frame.size.y);
-			auto& texture_frame = global_st.image_grp[(size_t)ImageTypes::IMAGEID_Warp_Texture]->frames.at(image->modifier_data1);
+			auto& texture_frame = global_st.get_image_grp((size_t)ImageTypes::IMAGEID_Warp_Texture)->frames.at(image->modifier_data1);
 			draw_frame(texture_frame, false, temporary_warp_texture_buffer.data(), frame.size.x, 0, 0, frame.size.x, frame.size.y);
 			draw_frame_textured(frame, temporary_warp_texture_buffer.data(), i_flag(image, image_t::flag_horizontally_flipped), dst, data_pitch, offset_x, offset_y, width, height);
 		} else if (image->modifier == 17) {
-			auto& data = tileset_img.light_pcx.at(0).data;
-			uint8_t* ptr = &data.at(256u * (image->modifier_data1 - 1));
+			auto& data = tileset_img->light_pcx.at(0).data;
+			const uint8_t* ptr = &data.at(256u * (image->modifier_data1 - 1));
 			size_t size = data.data() + data.size() - ptr;
 			auto glow = [ptr, size](uint8_t, uint8_t old_value) {
 				if (old_value >= size) return (uint8_t)0;
@@ -452,7 +456,7 @@ struct ui_functions: ui_util_functions {
 
 		xy map_pos = sprite->position + xy(0, sprite->sprite_type->selection_circle_vpos);
 
-		auto* grp = global_st.image_grp[(size_t)image_type->id];
+		auto* grp = global_st.get_image_grp((size_t)image_type->id);
 		auto& frame = grp->frames.at(0);
 
 		map_pos.x += int(frame.offset.x - grp->width / 2);
@@ -485,7 +489,7 @@ struct ui_functions: ui_util_functions {
 		size_t color_index = st.players[sprite->owner].color;
 		uint8_t color = global_ui_st.img.player_unit_colors.at(color_index)[0];
 		if (unit_is_mineral_field(u) || unit_is(u, UnitTypes::Resource_Vespene_Geyser)) {
-			color = tileset_img.resource_minimap_color;
+			color = tileset_img->resource_minimap_color;
 		}
 		auto player_color = [color](uint8_t new_value, uint8_t) {
 			if (new_value >= 0 && new_value < 8) return color;
@@ -499,7 +503,7 @@ struct ui_functions: ui_util_functions {
 
 		auto* selection_circle_image_type = get_image_type((ImageTypes)((int)ImageTypes::IMAGEID_Selection_Circle_22pixels + sprite->sprite_type->selection_circle));
 
-		auto* selection_circle_grp = global_st.image_grp[(size_t)selection_circle_image_type->id];
+		auto* selection_circle_grp = global_st.get_image_grp((size_t)selection_circle_image_type->id);
 		auto& selection_circle_frame = selection_circle_grp->frames.at(0);
 
 		int offsety = sprite->sprite_type->selection_circle_vpos + selection_circle_frame.size.y / 2 + 8;
@@ -688,6 +692,7 @@ struct ui_functions: ui_util_functions {
 	a_vector<std::pair<uint32_t, const sprite_t*>> sorted_sprites;
 
 	void draw_sprites(uint8_t* data, size_t data_pitch, rect screen_rect) {
+		OPENBW_PERF_SCOPE(perf_counters, timer_draw_sprites);
 
 		sorted_sprites.clear();
 
@@ -718,6 +723,7 @@ struct ui_functions: ui_util_functions {
 		for (auto& v : sorted_sprites) {
 			draw_sprite(v.second, data, data_pitch, screen_rect);
 		}
+		OPENBW_PERF_COUNT(perf_counters, counter_sprites_drawn, sorted_sprites.size());
 
 		for (auto* s : current_selection_sprites) {
 			current_selection_sprites_set.at(s->index) = nullptr;
@@ -762,7 +768,7 @@ struct ui_functions: ui_util_functions {
 	  size_t w = u->unit_type->placement_size.x / 32u;
 	  size_t h = u->unit_type->placement_size.y / 32u;
 	  if (unit_is_mineral_field(u) || unit_is(u, UnitTypes::Resource_Vespene_Geyser)) {
-		color = tileset_img.resource_minimap_color;
+		color = tileset_img->resource_minimap_color;
 	  }
 	  if (ut_building(u)) {
 		if (w > 4) w = 4;
@@ -777,6 +783,8 @@ struct ui_functions: ui_util_functions {
 	}
 
 	void draw_minimap(uint8_t* data, size_t data_pitch, size_t surface_width, size_t surface_height) {
+	  OPENBW_PERF_SCOPE(perf_counters, timer_draw_minimap);
+	  if (want_new_palette) set_image_data();
 	  auto surface_rect = rect{ xy{ 0, 0 }, xy{ (int)surface_width, (int)surface_height } };
 	  fill_rectangle(data, data_pitch, surface_rect, 0, surface_rect);
 
@@ -788,8 +796,8 @@ struct ui_functions: ui_util_functions {
 			  size_t index;
 			  if (~st.tiles[y * game_st.map_tile_width + x].flags & tile_t::flag_has_creep) index = st.tiles_mega_tile_index[y * game_st.map_tile_width + x];
 			  else index = cv5().at(1).mega_tile_index[global_ui_st.creep_random_tile_indices[y * game_st.map_tile_width + x]];
-			  auto* images = &tileset_img.vx4.at(index).images[0];
-			  auto* bitmap = &tileset_img.vr4.at(*images / 2).bitmap[0];
+			  auto* images = &tileset_img->vx4.at(index).images[0];
+			  auto* bitmap = &tileset_img->vr4.at(*images / 2).bitmap[0];
 			  auto val = bitmap[55 / sizeof(vr4_entry::bitmap_t)];
 			  size_t shift = 8 * (55 % sizeof(vr4_entry::bitmap_t));
 			  val >>= shift;
@@ -917,24 +925,27 @@ struct ui_functions: ui_util_functions {
 	}
 
 	void set_image_data() {
-		tileset_img = global_ui_st.all_tileset_img.at(game_st.tileset_index);
+		tileset_img = &global_ui_st.get_tileset_img(game_st.tileset_index);
 
 		want_new_palette = false;
 
-		if (tileset_img.wpe.size() != 256 * 4) error("wpe size invalid (%d)", tileset_img.wpe.size());
+		if (tileset_img->wpe.size() != 256 * 4) error("wpe size invalid (%d)", tileset_img->wpe.size());
 		for (size_t i = 0; i != 256; ++i) {
-			palette_colors[i].r = tileset_img.wpe[4 * i + 0];
-			palette_colors[i].g = tileset_img.wpe[4 * i + 1];
-			palette_colors[i].b = tileset_img.wpe[4 * i + 2];
-			palette_colors[i].a = tileset_img.wpe[4 * i + 3];
+			palette_colors[i].r = tileset_img->wpe[4 * i + 0];
+			palette_colors[i].g = tileset_img->wpe[4 * i + 1];
+			palette_colors[i].b = tileset_img->wpe[4 * i + 2];
+			palette_colors[i].a = tileset_img->wpe[4 * i + 3];
 		}
 	}
 
 	void reset() {
 		replay_frame = 0;
 		auto& game = *st.game;
-		st = state();
-		game = game_state();
+		{
+			arena_scope scope(player.arena());
+			st = state();
+			game = game_state();
+		}
 		replay_st = replay_state();
 		action_st = action_state();
 